@@ -18,6 +18,7 @@
 #include <fstream>
 #include <list>
 #include <map>
+#include <algorithm>
 
 #include <cstring>
 #include <cstdio>
@@ -26,14 +27,33 @@
 
 #include <netinet/ip6.h>
 #include <arpa/inet.h>
+#include <sys/random.h>
+#include <unistd.h>
+#include <time.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include "ndppd.h"
 #include "address.h"
+#include "address_map.h"
 #include "route.h"
+#include "netlink.h"
+#include "xsk.h"
 
 NDPPD_NS_BEGIN
 
-std::list<ptr<route> > address::_addresses;
+mutex address::_lock;
+
+address_map<std::vector<int> > address::_addresses;
+
+unsigned address::_version = 0;
+
+__thread address_map<std::vector<int> >* address::_snapshot = NULL;
+
+__thread unsigned address::_snapshot_version = 0;
+
+bool address::_monitored = false;
 
 int address::_ttl;
 
@@ -57,19 +77,6 @@ address::address(const address& addr)
     _mask.s6_addr32[3] = addr._mask.s6_addr32[3];
 }
 
-address::address(const ptr<address>& addr)
-{
-    _addr.s6_addr32[0] = addr->_addr.s6_addr32[0];
-    _addr.s6_addr32[1] = addr->_addr.s6_addr32[1];
-    _addr.s6_addr32[2] = addr->_addr.s6_addr32[2];
-    _addr.s6_addr32[3] = addr->_addr.s6_addr32[3];
-
-    _mask.s6_addr32[0] = addr->_mask.s6_addr32[0];
-    _mask.s6_addr32[1] = addr->_mask.s6_addr32[1];
-    _mask.s6_addr32[2] = addr->_mask.s6_addr32[2];
-    _mask.s6_addr32[3] = addr->_mask.s6_addr32[3];
-}
-
 address::address(const std::string& str)
 {
     parse_string(str);
@@ -343,30 +350,114 @@ bool address::is_unicast() const
     return _addr.s6_addr[0] != 0xff;
 }
 
-void address::add(const address& addr, const std::string& ifname)
+static uint64_t hash_mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static uint64_t hash_seed()
+{
+    uint64_t seed;
+
+    if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        seed = hash_mix(((uint64_t)ts.tv_sec << 32) ^ ts.tv_nsec ^ ((uint64_t)getpid() << 16));
+    }
+
+    return seed;
+}
+
+uint64_t address_hash(const struct in6_addr& addr)
+{
+    static const uint64_t seed = hash_seed();
+
+    uint64_t hi = ((uint64_t)addr.s6_addr32[0] << 32) | addr.s6_addr32[1];
+    uint64_t lo = ((uint64_t)addr.s6_addr32[2] << 32) | addr.s6_addr32[3];
+
+    return hash_mix(hash_mix(seed ^ hi) ^ lo);
+}
+
+void address::add(const address& addr, int ifindex)
 {
-    ptr<route> rt(new route(addr, ifname));
-    // logger::debug() << "address::create() addr=" << addr << ", ifname=" << ifname;
-    _addresses.push_back(rt);
+    mutex_lock ml(_lock);
+
+    std::vector<int>* ifindexes = _addresses.find(addr.const_addr());
+
+    if (!ifindexes) {
+        _addresses.insert(addr.const_addr(), std::vector<int>(1, ifindex));
+        xsk::add_local(addr);
+        changed();
+        return;
+    }
+
+    if (std::find(ifindexes->begin(), ifindexes->end(), ifindex) == ifindexes->end()) {
+        ifindexes->push_back(ifindex);
+        changed();
+    }
+}
+
+void address::remove(const address& addr, int ifindex)
+{
+    mutex_lock ml(_lock);
+
+    std::vector<int>* ifindexes = _addresses.find(addr.const_addr());
+
+    if (!ifindexes)
+        return;
+
+    ifindexes->erase(std::remove(ifindexes->begin(), ifindexes->end(), ifindex),
+                     ifindexes->end());
+
+    if (ifindexes->empty()) {
+        _addresses.erase(addr.const_addr());
+        xsk::remove_local(addr);
+    }
+
+    changed();
 }
 
-std::list<ptr<route> >::iterator address::addresses_begin()
+void address::changed()
 {
-    return _addresses.begin();
+    __atomic_add_fetch(&_version, 1, __ATOMIC_RELEASE);
 }
 
-std::list<ptr<route> >::iterator address::addresses_end()
+bool address::find_local(const address& addr, std::vector<int>* ifindexes)
 {
-    return _addresses.end();
+    if (!_snapshot || _snapshot_version != __atomic_load_n(&_version, __ATOMIC_ACQUIRE)) {
+        mutex_lock ml(_lock);
+
+        if (!_snapshot)
+            _snapshot = new address_map<std::vector<int> >();
+
+        *_snapshot        = _addresses;
+        _snapshot_version = _version;
+    }
+
+    const std::vector<int>* found = _snapshot->find(addr.const_addr());
+
+    if (!found)
+        return false;
+
+    if (ifindexes)
+        *ifindexes = *found;
+
+    return true;
 }
 
 void address::load(const std::string& path)
 {
-    // Hack to make sure the addresses are not freed prematurely.
-    std::list<ptr<route> > tmp_addresses(_addresses);
+    mutex_lock ml(_lock);
+
     _addresses.clear();
+    changed();
 
-    logger::debug() << "reading IP addresses";
+    DEBUG_LOG() << "reading IP addresses";
 
     try {
         std::ifstream ifs;
@@ -380,7 +471,7 @@ void address::load(const std::string& path)
 
             if (ifs.gcount() < 53) {
                 if (ifs.gcount() > 0)
-                    logger::debug() << "skipping entry (size=" << ifs.gcount() << ")";
+                    DEBUG_LOG() << "skipping entry (size=" << ifs.gcount() << ")";
                 continue;
             }
 
@@ -395,26 +486,107 @@ void address::load(const std::string& path)
             
             std::string iface = route::token(buf + 45);
 
-            address::add(addr, iface);
+            address::add(addr, if_nametoindex(iface.c_str()));
             
-            logger::debug() << "found local addr=" << addr << ", iface=" << iface;
+            DEBUG_LOG() << "found local addr=" << addr << ", iface=" << iface;
         }
     } catch (std::ifstream::failure e) {
         logger::warning() << "Failed to parse IPv6 address data from '" << path << "'";
         logger::error() << e.what();
     }
     
-    logger::debug() << "completed IP addresses load";
+    DEBUG_LOG() << "completed IP addresses load";
+}
+
+bool address::monitor()
+{
+    if (_monitored)
+        return true;
+
+    if (!netlink::open() || !netlink::subscribe(RTNLGRP_IPV6_IFADDR) || !reload()) {
+        logger::warning() << "Failed to set up netlink address monitoring, falling back to "
+                          << "reading /proc/net/if_inet6";
+        return false;
+    }
+
+    _monitored = true;
+
+    return true;
+}
+
+bool address::reload()
+{
+    DEBUG_LOG() << "reading IP addresses";
+
+    {
+        mutex_lock ml(_lock);
+        _addresses.clear();
+        changed();
+    }
+
+    return netlink::dump(RTM_GETADDR);
+}
+
+void address::handle_netlink(const struct nlmsghdr* hdr)
+{
+    const struct ifaddrmsg* ifa = (const struct ifaddrmsg*)NLMSG_DATA(hdr);
+
+    if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)) || ifa->ifa_family != AF_INET6)
+        return;
+
+    const struct in6_addr* local = NULL;
+    const struct in6_addr* peer  = NULL;
+
+    int len = IFA_PAYLOAD(hdr);
+
+    for (const struct rtattr* rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (RTA_PAYLOAD(rta) < sizeof(struct in6_addr))
+            continue;
+
+        if (rta->rta_type == IFA_LOCAL)
+            local = (const struct in6_addr*)RTA_DATA(rta);
+        else if (rta->rta_type == IFA_ADDRESS)
+            peer = (const struct in6_addr*)RTA_DATA(rta);
+    }
+
+    // IFA_ADDRESS is the peer's address on point-to-point links, in which
+    // case our own is in IFA_LOCAL.
+    if (!local)
+        local = peer;
+
+    if (!local)
+        return;
+
+    address addr(*local);
+
+    if (hdr->nlmsg_type == RTM_NEWADDR) {
+        DEBUG_LOG() << "found local addr=" << addr << ", ifindex=" << ifa->ifa_index;
+        add(addr, ifa->ifa_index);
+    } else {
+        DEBUG_LOG() << "lost local addr=" << addr << ", ifindex=" << ifa->ifa_index;
+        remove(addr, ifa->ifa_index);
+    }
 }
 
 void address::update(int elapsed_time)
 {
+    if (_monitored)
+        return;
+
     if ((_c_ttl -= elapsed_time) <= 0) {
         load("/proc/net/if_inet6");
         _c_ttl = _ttl;
     }
 }
 
+int address::next_update()
+{
+    if (_monitored)
+        return -1;
+
+    return (_c_ttl > 0) ? _c_ttl : 0;
+}
+
 int address::ttl()
 {
     return _ttl;
@@ -16,10 +16,14 @@
 #pragma once
 
 #include <string>
-#include <list>
+#include <vector>
 #include <netinet/ip6.h>
 
 #include "ndppd.h"
+#include "address_map.h"
+#include "mutex.h"
+
+struct nlmsghdr;
 
 NDPPD_NS_BEGIN
 
@@ -31,7 +35,6 @@ class address {
 public:
     address();
     address(const address& addr);
-    address(const ptr<address>& addr);
     address(const std::string& str);
     address(const char* str);
     address(const in6_addr& addr);
@@ -40,6 +43,10 @@ public:
     
     static void update(int elapsed_time);
 
+    // Returns the number of milliseconds until the next reload, or -1 if
+    // the local addresses are kept up to date over netlink.
+    static int next_update();
+
     static int ttl();
 
     static void ttl(int ttl);
@@ -73,20 +80,56 @@ public:
 
     operator std::string() const;
     
-    static void add(const address& addr, const std::string& ifname);
-    
+    static void add(const address& addr, int ifindex);
+
+    static void remove(const address& addr, int ifindex);
+
+    // Returns true if 'addr' is one of our addresses, and stores the
+    // indexes of the interfaces it's assigned to in 'ifindexes' if given.
+    // Only takes _lock if the addresses changed since the calling thread
+    // last looked.
+    static bool find_local(const address& addr, std::vector<int>* ifindexes = NULL);
+
     static void load(const std::string& path);
-    
-    static std::list<ptr<route> >::iterator addresses_begin();
-    
-    static std::list<ptr<route> >::iterator addresses_end();
+
+    // Loads the local addresses over netlink and keeps them up to date
+    // from then on. Returns false if that isn't possible, in which case
+    // they're reloaded from /proc/net/if_inet6 every ttl() ms instead.
+    static bool monitor();
+
+    // Replaces the local addresses with a full dump of the kernel's.
+    static bool reload();
+
+    static void handle_netlink(const struct nlmsghdr* hdr);
 
 private:
+    // Copies out _addr and _mask as they are, for formatting later.
+    friend class logger;
+
+    // Guards _addresses, which the main thread keeps up to date. The
+    // workers look up their own copy of it instead; see find_local().
+    static mutex _lock;
+
+    // Bumped whenever _addresses changes.
+    static unsigned _version;
+
+    // The calling thread's copy of _addresses, and the _version it was
+    // taken at. Never freed, like the session timers.
+    static __thread address_map<std::vector<int> >* _snapshot;
+
+    static __thread unsigned _snapshot_version;
+
+    // Has the threads take a new copy of _addresses; _lock must be held.
+    static void changed();
+
     static int _ttl;
 
     static int _c_ttl;
-    
-    static std::list<ptr<route> > _addresses;
+
+    // Whether the local addresses are kept up to date over netlink.
+    static bool _monitored;
+
+    static address_map<std::vector<int> > _addresses;
     
     struct in6_addr _addr, _mask;
 };
@@ -0,0 +1,182 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// Returns a hash of the 128-bit address 'addr'. The hash is keyed with a
+// random value chosen at startup, so that nobody can pick target addresses
+// that all end up in the same bucket.
+uint64_t address_hash(const struct in6_addr& addr);
+
+// An open-addressing hash table (linear probing) keyed on 128-bit IPv6
+// addresses. Erasing uses backward-shift deletion, so there are no
+// tombstones and lookups stay short even after many removals.
+
+template <typename T>
+class address_map {
+public:
+    address_map() :
+        _size(0)
+    {
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return !_size;
+    }
+
+    // Returns a pointer to the value stored for 'key', or NULL. The pointer
+    // is only valid until the map is modified.
+    T* find(const struct in6_addr& key)
+    {
+        if (!_size)
+            return NULL;
+
+        size_t mask = _slots.size() - 1;
+
+        for (size_t i = address_hash(key) & mask; _slots[i].used; i = (i + 1) & mask) {
+            if (same(_slots[i].key, key))
+                return &_slots[i].value;
+        }
+
+        return NULL;
+    }
+
+    // Stores 'value' for 'key', replacing any previous value.
+    void insert(const struct in6_addr& key, const T& value)
+    {
+        T* p = find(key);
+
+        if (p) {
+            *p = value;
+            return;
+        }
+
+        if ((_size + 1) * 4 > _slots.size() * 3)
+            rehash(_slots.empty() ? 16 : _slots.size() * 2);
+
+        place(key, value);
+        _size++;
+    }
+
+    // Removes 'key' from the map. Returns false if it wasn't there.
+    bool erase(const struct in6_addr& key)
+    {
+        if (!_size)
+            return false;
+
+        size_t mask = _slots.size() - 1;
+        size_t i    = address_hash(key) & mask;
+
+        while (_slots[i].used && !same(_slots[i].key, key))
+            i = (i + 1) & mask;
+
+        if (!_slots[i].used)
+            return false;
+
+        // Hold on to the value until the table is consistent again, in case
+        // releasing it ends up back here.
+        T old = _slots[i].value;
+
+        // Shift back any entry that would become unreachable.
+        for (size_t j = (i + 1) & mask; _slots[j].used; j = (j + 1) & mask) {
+            size_t home = address_hash(_slots[j].key) & mask;
+
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                _slots[i] = _slots[j];
+                i = j;
+            }
+        }
+
+        _slots[i].used  = false;
+        _slots[i].value = T();
+        _size--;
+
+        if (_slots.size() > 16 && _size * 8 < _slots.size())
+            rehash(_slots.size() / 2);
+
+        return true;
+    }
+
+    void clear()
+    {
+        std::vector<slot> tmp;
+        tmp.swap(_slots);
+        _size = 0;
+    }
+
+private:
+    struct slot {
+        struct in6_addr key;
+        T value;
+        bool used;
+
+        slot() :
+            value(), used(false)
+        {
+        }
+    };
+
+    std::vector<slot> _slots;
+
+    size_t _size;
+
+    static bool same(const struct in6_addr& a, const struct in6_addr& b)
+    {
+        return !((a.s6_addr32[0] ^ b.s6_addr32[0]) |
+                 (a.s6_addr32[1] ^ b.s6_addr32[1]) |
+                 (a.s6_addr32[2] ^ b.s6_addr32[2]) |
+                 (a.s6_addr32[3] ^ b.s6_addr32[3]));
+    }
+
+    void place(const struct in6_addr& key, const T& value)
+    {
+        size_t mask = _slots.size() - 1;
+        size_t i    = address_hash(key) & mask;
+
+        while (_slots[i].used)
+            i = (i + 1) & mask;
+
+        _slots[i].key   = key;
+        _slots[i].value = value;
+        _slots[i].used  = true;
+    }
+
+    void rehash(size_t n)
+    {
+        std::vector<slot> old(n);
+        old.swap(_slots);
+
+        for (typename std::vector<slot>::iterator it = old.begin(); it != old.end(); it++) {
+            if (it->used)
+                place(it->key, it->value);
+        }
+    }
+};
+
+NDPPD_NS_END
@@ -25,7 +25,7 @@
 
 NDPPD_NS_BEGIN
 
-class conf {
+class conf : public ptr_object {
 public:
 
 private:
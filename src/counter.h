@@ -0,0 +1,89 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <new>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// Describes one of the counters of a counter_block, for the stats
+// endpoint.
+struct counter_info {
+    const char* name;
+
+    const char* help;
+
+    // Whether it's a level that goes up and down rather than a count.
+    bool gauge;
+};
+
+// N counters that may be bumped from any thread. They're kept on cache
+// lines of their own, so that the threads updating them don't get in the
+// way of those using the object they're counting for, and updated with
+// relaxed atomics, as nobody relies on their order.
+
+template <size_t N>
+class counter_block {
+public:
+    counter_block()
+    {
+        void* mem;
+
+        if (posix_memalign(&mem, CACHE_LINE, SIZE))
+            throw std::bad_alloc();
+
+        memset(mem, 0, SIZE);
+        _values = (uint64_t* )mem;
+    }
+
+    ~counter_block()
+    {
+        free(_values);
+    }
+
+    void add(int which, uint64_t n = 1)
+    {
+        __atomic_fetch_add(&_values[which], n, __ATOMIC_RELAXED);
+    }
+
+    void sub(int which, uint64_t n = 1)
+    {
+        __atomic_fetch_sub(&_values[which], n, __ATOMIC_RELAXED);
+    }
+
+    uint64_t get(int which) const
+    {
+        return __atomic_load_n(&_values[which], __ATOMIC_RELAXED);
+    }
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    static const size_t SIZE = (N * sizeof(uint64_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+    uint64_t* _values;
+
+    counter_block(const counter_block&);
+
+    counter_block& operator=(const counter_block&);
+};
+
+NDPPD_NS_END
@@ -24,13 +24,15 @@
 #include <netinet/ip6.h>
 #include <netinet/icmp6.h>
 #include <netinet/ether.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include <linux/filter.h>
 
@@ -38,9 +40,12 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 #include "ndppd.h"
 #include "route.h"
+#include "xsk.h"
+#include "nd_packet.h"
 
 NDPPD_NS_BEGIN
 
@@ -48,21 +53,66 @@ std::map<std::string, weak_ptr<iface> > iface::_map;
 
 bool iface::_map_dirty = false;
 
-std::vector<struct pollfd> iface::_pollfds;
+mutex iface::_lock;
+
+__thread int iface::_epfd = -1;
+
+std::map<int, iface::slot_queue*> iface::_retired;
+
+__thread iface::slot_queue* iface::_my_retired = NULL;
+
+std::map<int, iface::event_slot*> iface::_watchers;
+
+__thread long long iface::_now = 0;
+
+__thread struct mmsghdr iface::_recv_hdrs[iface::RECV_BATCH];
+
+__thread struct iovec iface::_recv_iovs[iface::RECV_BATCH];
+
+__thread struct sockaddr_storage iface::_recv_addrs[iface::RECV_BATCH];
+
+__thread uint8_t iface::_recv_bufs[iface::RECV_BATCH][256];
+
+__thread uint64_t iface::_recv_ctrl[iface::RECV_BATCH][iface::RECV_CTRL_SIZE / sizeof(uint64_t)];
+
+__thread struct mmsghdr iface::_send_hdrs[iface::SEND_BATCH];
+
+__thread struct iovec iface::_send_iovs[iface::SEND_BATCH];
+
+__thread struct sockaddr_in6 iface::_send_addrs[iface::SEND_BATCH];
+
+__thread uint8_t iface::_send_bufs[iface::SEND_BATCH][iface::SOLICIT_SIZE];
+
+__thread std::vector<iface::queued_solicit>* iface::_solicits = NULL;
+
+const counter_info iface::counter_infos[iface::COUNTERS] = {
+    { "ns_received",   "Neighbor solicitations received", false },
+    { "na_received",   "Neighbor advertisements received", false },
+    { "ns_sent",       "Neighbor solicitations sent", false },
+    { "na_sent",       "Neighbor advertisements sent", false },
+    { "malformed",     "Malformed messages dropped", false },
+    { "local_answers", "Solicitations answered for addresses of the host", false },
+    { "send_errors",   "Messages that couldn't be sent", false }
+};
 
 iface::iface() :
-    _ifd(-1), _pfd(-1), _name("")
+    _loop(-1), _ifd(-1), _pfd(-1), _xsk_frame(NULL), _ring(NULL), _ring_size(0), _ring_block_size(0), _ring_blocks(0),
+    _ring_block(0), _name("")
 {
 }
 
 iface::~iface()
 {
-    logger::debug() << "iface::~iface()";
+    DEBUG_LOG() << "iface::~iface()";
 
-    if (_ifd >= 0)
+    if (_ifd >= 0) {
+        epoll_del(_ifd);
         close(_ifd);
+    }
 
     if (_pfd >= 0) {
+        epoll_del(_pfd);
+
         if (_prev_allmulti >= 0) {
             allmulti(_prev_allmulti);
         }
@@ -72,25 +122,40 @@ iface::~iface()
         close(_pfd);
     }
 
-    _map_dirty = true;
+    if (_ring) {
+        munmap(_ring, _ring_size);
+    }
+
+    if (_xsk) {
+        epoll_del(_xsk->fd());
+    }
+
+    for (std::vector<int>::iterator it = _fanout.begin(); it != _fanout.end(); it++) {
+        epoll_del(*it);
+        close(*it);
+    }
+
+    mutex_lock ml(_lock);
+
+    __atomic_store_n(&_map_dirty, true, __ATOMIC_RELEASE);
     
     _serves.clear();
     _parents.clear();
 }
 
-ptr<iface> iface::open_pfd(const std::string& name, bool promiscuous)
+ptr<iface> iface::open_pfd(const std::string& name, bool promiscuous, bool rx_ring, bool xdp)
 {
     int fd = 0;
 
+    mutex_lock ml(_lock);
+
     std::map<std::string, weak_ptr<iface> >::iterator it = _map.find(name);
 
     ptr<iface> ifa;
 
-    if (it != _map.end()) {
-        if (it->second->_pfd >= 0)
-            return it->second;
-
-        ifa = it->second;
+    if (it != _map.end() && (ifa = it->second.lock())) {
+        if (ifa->_pfd >= 0)
+            return ifa;
     } else {
         // We need an _ifs, so let's set one up.
         ifa = open_ifd(name);
@@ -106,6 +171,58 @@ ptr<iface> iface::open_pfd(const std::string& name, bool promiscuous)
         return ptr<iface>();
     }
 
+    // Map a receive ring, if asked to.
+
+    if (rx_ring == true && !ifa->_ring && !ifa->map_ring(fd)) {
+        logger::warning() << "Failed to set up rx-ring on interface '" << name << "', "
+                          << "falling back to regular reads";
+    }
+
+    if (!setup_pfd(fd, name)) {
+        close(fd);
+        return ptr<iface>();
+    }
+
+    if (!ifa->epoll_add(fd, EV_PFD)) {
+        close(fd);
+        return ptr<iface>();
+    }
+
+    // Set up an instance of 'iface'.
+
+    ifa->_pfd = fd;
+
+    // Steer solicitations to an AF_XDP socket, if asked to. Whatever the XDP
+    // program lets through still arrives on _pfd.
+
+    if (xdp == true && !ifa->_xsk) {
+        ptr<xsk> xs = xsk::open(name);
+
+        if (xs && ifa->epoll_add(xs->fd(), EV_XSK)) {
+            ifa->_xsk = xs;
+        } else {
+            logger::warning() << "Failed to set up XDP on interface '" << name << "', "
+                              << "falling back to regular reads";
+        }
+    }
+
+    // Eh. Allmulti.
+    ifa->_prev_allmulti = ifa->allmulti(1);
+    
+    // Eh. Promiscuous
+    if (promiscuous == true) {
+        ifa->_prev_promiscuous = ifa->promiscuous(1);
+    } else {
+        ifa->_prev_promiscuous = -1;
+    }
+
+    _map_dirty = true;
+
+    return ifa;
+}
+
+bool iface::setup_pfd(int fd, const std::string& name)
+{
     // Bind to the specified interface.
 
     struct sockaddr_ll lladdr;
@@ -115,15 +232,13 @@ ptr<iface> iface::open_pfd(const std::string& name, bool promiscuous)
     lladdr.sll_protocol = htons(ETH_P_IPV6);
 
     if (!(lladdr.sll_ifindex = if_nametoindex(name.c_str()))) {
-        close(fd);
         logger::error() << "Failed to bind to interface '" << name << "'";
-        return ptr<iface>();
+        return false;
     }
 
     if (bind(fd, (struct sockaddr* )&lladdr, sizeof(struct sockaddr_ll)) < 0) {
-        close(fd);
         logger::error() << "Failed to bind to interface '" << name << "'";
-        return ptr<iface>();
+        return false;
     }
 
     // Switch to non-blocking mode.
@@ -131,9 +246,8 @@ ptr<iface> iface::open_pfd(const std::string& name, bool promiscuous)
     int on = 1;
 
     if (ioctl(fd, FIONBIO, (char* )&on) < 0) {
-        close(fd);
         logger::error() << "Failed to switch to non-blocking on interface '" << name << "'";
-        return ptr<iface>();
+        return false;
     }
 
     // Set up filter.
@@ -167,36 +281,125 @@ ptr<iface> iface::open_pfd(const std::string& name, bool promiscuous)
 
     if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
         logger::error() << "Failed to set filter";
-        return ptr<iface>();
+        return false;
     }
 
-    // Set up an instance of 'iface'.
+    return true;
+}
 
-    ifa->_pfd = fd;
+bool iface::fanout(int count)
+{
+    if (_pfd < 0 || count <= (int)_fanout.size() + 1)
+        return true;
 
-    // Eh. Allmulti.
-    ifa->_prev_allmulti = ifa->allmulti(1);
-    
-    // Eh. Promiscuous
-    if (promiscuous == true) {
-        ifa->_prev_promiscuous = ifa->promiscuous(1);
-    } else {
-        ifa->_prev_promiscuous = -1;
+    if (!_fanout.empty()) {
+        logger::warning() << "Interface '" << _name << "' is already spread over "
+                          << (int)_fanout.size() + 1 << " sockets";
+        return false;
     }
 
-    _map_dirty = true;
+    // Have the kernel pick a group id nobody else on the host is using.
 
-    return ifa;
+    int arg = (PACKET_FANOUT_CBPF | PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+
+    if (setsockopt(_pfd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+        logger::warning() << "Failed to set up fanout on interface '" << _name << "': "
+                          << logger::err();
+        return false;
+    }
+
+    socklen_t len = sizeof(arg);
+
+    if (getsockopt(_pfd, SOL_PACKET, PACKET_FANOUT, &arg, &len) < 0) {
+        logger::warning() << "Failed to set up fanout on interface '" << _name << "': "
+                          << logger::err();
+        return false;
+    }
+
+    // Pick the socket by the last 32 bits of the target address, modulo
+    // the number of sockets (the kernel takes care of that part). Unlike
+    // PACKET_FANOUT_HASH, this doesn't depend on who's asking, so all
+    // solicitations for one target end up in the same place.
+
+    static struct sock_filter filter[] = {
+        // Load the last word of nd_ns_target, relative to the IPv6 header.
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+            (u_int32_t)(SKF_NET_OFF + (int)(sizeof(struct ip6_hdr) +
+                offsetof(struct nd_neighbor_solicit, nd_ns_target) + 12))),
+        BPF_STMT(BPF_RET | BPF_A, 0)
+    };
+
+    static struct sock_fprog fprog = {
+        2,
+        filter
+    };
+
+    if (setsockopt(_pfd, SOL_PACKET, PACKET_FANOUT_DATA, &fprog, sizeof(fprog)) < 0) {
+        logger::warning() << "Failed to set up fanout on interface '" << _name << "': "
+                          << logger::err();
+        return false;
+    }
+
+    int id = arg & 0xffff;
+
+    for (int i = 1; i < count; i++) {
+        int fd;
+
+        if ((fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_IPV6))) < 0) {
+            logger::error() << "Unable to create socket";
+            return false;
+        }
+
+        if (!setup_pfd(fd, _name)) {
+            close(fd);
+            return false;
+        }
+
+        arg = (PACKET_FANOUT_CBPF << 16) | id;
+
+        if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+            logger::warning() << "Failed to add socket to fanout group on interface '" << _name
+                              << "': " << logger::err();
+            close(fd);
+            return false;
+        }
+
+        if (!epoll_add(fd, EV_PFD)) {
+            close(fd);
+            return false;
+        }
+
+        _fanout.push_back(fd);
+        _fanout_loops.push_back(_loop);
+    }
+
+    return true;
+}
+
+int iface::fanout() const
+{
+    return _fanout.size() + 1;
+}
+
+int iface::fanout_index(const address& taddr, int count)
+{
+    return (count > 1) ? ntohl(taddr.const_addr().s6_addr32[3]) % count : 0;
 }
 
 ptr<iface> iface::open_ifd(const std::string& name)
 {
     int fd;
 
+    mutex_lock ml(_lock);
+
     std::map<std::string, weak_ptr<iface> >::iterator it = _map.find(name);
 
-    if ((it != _map.end()) && it->second->_ifd)
-        return it->second;
+    if (it != _map.end()) {
+        ptr<iface> ifa = it->second.lock();
+
+        if (ifa && ifa->_ifd)
+            return ifa;
+    }
 
     // Create a socket.
 
@@ -233,7 +436,7 @@ ptr<iface> iface::open_ifd(const std::string& name)
         return ptr<iface>();
     }
 
-    logger::debug()
+    DEBUG_LOG()
         << "fd=" << fd << ", hwaddr="
         << ether_ntoa((const struct ether_addr* )&ifr.ifr_hwaddr.sa_data);
 
@@ -255,10 +458,19 @@ ptr<iface> iface::open_ifd(const std::string& name)
         return ptr<iface>();
     }
 
-    // Switch to non-blocking mode.
+    // Have the hop limit passed along, so that adverts that didn't come
+    // from the link itself can be told apart.
 
     int on = 1;
 
+    if (setsockopt(fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on)) < 0) {
+        close(fd);
+        logger::error() << "iface::open_ifd() failed IPV6_RECVHOPLIMIT";
+        return ptr<iface>();
+    }
+
+    // Switch to non-blocking mode.
+
     if (ioctl(fd, FIONBIO, (char*)&on) < 0) {
         close(fd);
         logger::error()
@@ -282,53 +494,56 @@ ptr<iface> iface::open_ifd(const std::string& name)
 
     ptr<iface> ifa;
 
-    if (it == _map.end()) {
+    if (it == _map.end() || !(ifa = it->second.lock())) {
         ifa = new iface();
         ifa->_name = name;
-        ifa->_ptr  = ifa;
 
         _map[name] = ifa;
-    } else {
-        ifa = it->second;
+    }
+
+    if (!ifa->epoll_add(fd, EV_IFD)) {
+        close(fd);
+        return ptr<iface>();
     }
 
     ifa->_ifd = fd;
 
     memcpy(&ifa->hwaddr, ifr.ifr_hwaddr.sa_data, sizeof(struct ether_addr));
 
+    ifa->build_templates();
+
     _map_dirty = true;
 
     return ifa;
 }
 
-ssize_t iface::read(int fd, struct sockaddr* saddr, ssize_t saddr_size, uint8_t* msg, size_t size)
+int iface::read(int fd)
 {
-    struct msghdr mhdr;
-    struct iovec iov;
-    int len;
-
-    if (!msg || (size < 0))
-        return -1;
+    for (int i = 0; i < RECV_BATCH; i++) {
+        _recv_iovs[i].iov_base = _recv_bufs[i];
+        _recv_iovs[i].iov_len  = sizeof(_recv_bufs[i]);
+
+        memset(&_recv_hdrs[i], 0, sizeof(struct mmsghdr));
+        _recv_hdrs[i].msg_hdr.msg_name    = &_recv_addrs[i];
+        _recv_hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        _recv_hdrs[i].msg_hdr.msg_iov     = &_recv_iovs[i];
+        _recv_hdrs[i].msg_hdr.msg_iovlen  = 1;
+        _recv_hdrs[i].msg_hdr.msg_control    = _recv_ctrl[i];
+        _recv_hdrs[i].msg_hdr.msg_controllen = sizeof(_recv_ctrl[i]);
+    }
 
-    iov.iov_len = size;
-    iov.iov_base = (caddr_t)msg;
+    int len;
 
-    memset(&mhdr, 0, sizeof(mhdr));
-    mhdr.msg_name = (caddr_t)saddr;
-    mhdr.msg_namelen = saddr_size;
-    mhdr.msg_iov =& iov;
-    mhdr.msg_iovlen = 1;
-    
-    if ((len = recvmsg(fd,& mhdr, 0)) < 0)
+    if ((len = recvmmsg(fd, _recv_hdrs, RECV_BATCH, MSG_DONTWAIT, NULL)) < 0)
     {
-        logger::error() << "iface::read() failed! error=" << logger::err() << ", ifa=" << name();
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        logger::error() << "iface::read() failed! error=" << logger::syserr << ", ifa=" << name();
         return -1;
     }
     
-    logger::debug() << "iface::read() ifa=" << name() << ", len=" << len;
-
-    if (len < sizeof(struct icmp6_hdr))
-        return -1;
+    DEBUG_LOG() << "iface::read() ifa=" << name() << ", count=" << len;
 
     return len;
 }
@@ -353,408 +568,1038 @@ ssize_t iface::write(int fd, const address& daddr, const uint8_t* msg, size_t si
     mhdr.msg_iov =& iov;
     mhdr.msg_iovlen = 1;
 
-    logger::debug() << "iface::write() ifa=" << name() << ", daddr=" << daddr.to_string() << ", len="
+    DEBUG_LOG() << "iface::write() ifa=" << name() << ", daddr=" << daddr << ", len="
                     << size;
 
     int len;
 
     if ((len = sendmsg(fd,& mhdr, 0)) < 0)
     {
-        logger::error() << "iface::write() failed! error=" << logger::err() << ", ifa=" << name() << ", daddr=" << daddr.to_string();
+        logger::error() << "iface::write() failed! error=" << logger::syserr << ", ifa=" << name() << ", daddr=" << daddr;
         return -1;
     }
 
     return len;
 }
 
-ssize_t iface::read_solicit(address& saddr, address& daddr, address& taddr)
+ssize_t iface::read_solicit(const uint8_t* msg, ssize_t len, address& saddr, address& daddr, address& taddr)
 {
-    struct sockaddr_ll t_saddr;
-    uint8_t msg[256];
-    ssize_t len;
+    nd_packet pkt;
 
-    if ((len = read(_pfd, (struct sockaddr*)&t_saddr, sizeof(struct sockaddr_ll), msg, sizeof(msg))) < 0) {
-        logger::warning() << "iface::read_solicit() failed: " << logger::err();
+    if (len < 0 || !pkt.parse_frame(msg, len) || pkt.type() != ND_NEIGHBOR_SOLICIT)
         return -1;
-    }
 
-    struct ip6_hdr* ip6h =
-          (struct ip6_hdr* )(msg + ETH_HLEN);
-
-    struct nd_neighbor_solicit*  ns =
-        (struct nd_neighbor_solicit*)(msg + ETH_HLEN + sizeof(struct ip6_hdr));
-
-    taddr = ns->nd_ns_target;
-    daddr = ip6h->ip6_dst;
-    saddr = ip6h->ip6_src;
+    taddr = pkt.target();
+    daddr = pkt.dst();
+    saddr = pkt.src();
     
     // Ignore packets sent from this machine
     if (iface::is_local(saddr) == true) {
         return 0;
     }
 
-    logger::debug() << "iface::read_solicit() saddr=" << saddr.to_string()
-                    << ", daddr=" << daddr.to_string() << ", taddr=" << taddr.to_string() << ", len=" << len;
+    DEBUG_LOG() << "iface::read_solicit() saddr=" << saddr
+                    << ", daddr=" << daddr << ", taddr=" << taddr << ", len=" << len;
 
     return len;
 }
 
-ssize_t iface::write_solicit(const address& taddr)
+void iface::build_templates()
 {
-    char buf[128];
-
-    memset(buf, 0, sizeof(buf));
+    memset(_solicit_tmpl, 0, SOLICIT_SIZE);
 
     struct nd_neighbor_solicit* ns =
-        (struct nd_neighbor_solicit* )&buf[0];
+        (struct nd_neighbor_solicit* )&_solicit_tmpl[0];
 
     struct nd_opt_hdr* opt =
-        (struct nd_opt_hdr* )&buf[sizeof(struct nd_neighbor_solicit)];
+        (struct nd_opt_hdr* )&_solicit_tmpl[sizeof(struct nd_neighbor_solicit)];
 
     opt->nd_opt_type = ND_OPT_SOURCE_LINKADDR;
     opt->nd_opt_len  = 1;
 
     ns->nd_ns_type   = ND_NEIGHBOR_SOLICIT;
 
-    memcpy(&ns->nd_ns_target,& taddr.const_addr(), sizeof(struct in6_addr));
-
-    memcpy(buf + sizeof(struct nd_neighbor_solicit) + sizeof(struct nd_opt_hdr),
+    memcpy(_solicit_tmpl + sizeof(struct nd_neighbor_solicit) + sizeof(struct nd_opt_hdr),
            &hwaddr, 6);
 
-    // FIXME: Alright, I'm lazy.
-    static address multicast("ff02::1:ff00:0000");
+    for (int i = 0; i < 4; i++) {
+        uint8_t* buf = _advert_tmpl[i];
 
-    address daddr;
+        memset(buf, 0, ADVERT_SIZE);
 
-    daddr = multicast;
+        struct nd_neighbor_advert* na =
+            (struct nd_neighbor_advert* )&buf[0];
 
-    daddr.addr().s6_addr[13] = taddr.const_addr().s6_addr[13];
-    daddr.addr().s6_addr[14] = taddr.const_addr().s6_addr[14];
-    daddr.addr().s6_addr[15] = taddr.const_addr().s6_addr[15];
+        struct nd_opt_hdr* opt =
+            (struct nd_opt_hdr* )&buf[sizeof(struct nd_neighbor_advert)];
 
-    logger::debug() << "iface::write_solicit() taddr=" << taddr.to_string()
-                    << ", daddr=" << daddr.to_string();
+        opt->nd_opt_type         = ND_OPT_TARGET_LINKADDR;
+        opt->nd_opt_len          = 1;
 
-    return write(_ifd, daddr, (uint8_t* )buf, sizeof(struct nd_neighbor_solicit)
-                 + sizeof(struct nd_opt_hdr) + 6);
+        na->nd_na_type           = ND_NEIGHBOR_ADVERT;
+        na->nd_na_flags_reserved = ((i & 1) ? ND_NA_FLAG_SOLICITED : 0) | ((i & 2) ? ND_NA_FLAG_ROUTER : 0);
+
+        memcpy(buf + sizeof(struct nd_neighbor_advert) + sizeof(struct nd_opt_hdr),
+               &hwaddr, 6);
+    }
 }
 
-ssize_t iface::write_advert(const address& daddr, const address& taddr, bool router)
+size_t iface::build_solicit(uint8_t* buf, const address& taddr, address& daddr)
 {
-    char buf[128];
-
-    memset(buf, 0, sizeof(buf));
-
-    struct nd_neighbor_advert* na =
-        (struct nd_neighbor_advert* )&buf[0];
-
-    struct nd_opt_hdr* opt =
-        (struct nd_opt_hdr* )&buf[sizeof(struct nd_neighbor_advert)];
-
-    opt->nd_opt_type         = ND_OPT_TARGET_LINKADDR;
-    opt->nd_opt_len          = 1;
+    memcpy(buf, _solicit_tmpl, SOLICIT_SIZE);
 
-    na->nd_na_type           = ND_NEIGHBOR_ADVERT;
-    na->nd_na_flags_reserved = (daddr.is_multicast() ? 0 : ND_NA_FLAG_SOLICITED) | (router ? ND_NA_FLAG_ROUTER : 0);
+    memcpy(&((struct nd_neighbor_solicit* )buf)->nd_ns_target, &taddr.const_addr(), sizeof(struct in6_addr));
 
-    memcpy(&na->nd_na_target,& taddr.const_addr(), sizeof(struct in6_addr));
+    // The solicited-node address, ff02::1:ffXX:XXXX.
+    daddr.reset();
 
-    memcpy(buf + sizeof(struct nd_neighbor_advert) + sizeof(struct nd_opt_hdr),
-           &hwaddr, 6);
+    struct in6_addr& dst = daddr.addr();
 
-    logger::debug() << "iface::write_advert() daddr=" << daddr.to_string()
-                    << ", taddr=" << taddr.to_string();
+    dst.s6_addr[0]  = 0xff;
+    dst.s6_addr[1]  = 0x02;
+    dst.s6_addr[11] = 0x01;
+    dst.s6_addr[12] = 0xff;
+    dst.s6_addr[13] = taddr.const_addr().s6_addr[13];
+    dst.s6_addr[14] = taddr.const_addr().s6_addr[14];
+    dst.s6_addr[15] = taddr.const_addr().s6_addr[15];
 
-    return write(_ifd, daddr, (uint8_t* )buf, sizeof(struct nd_neighbor_advert) +
-        sizeof(struct nd_opt_hdr) + 6);
+    return SOLICIT_SIZE;
 }
 
-ssize_t iface::read_advert(address& saddr, address& taddr)
+ssize_t iface::write_solicit(const address& taddr)
 {
-    struct sockaddr_in6 t_saddr;
-    uint8_t msg[256];
-    ssize_t len;
-    
-    memset(&t_saddr, 0, sizeof(struct sockaddr_in6));
-    t_saddr.sin6_family = AF_INET6;
-    t_saddr.sin6_port   = htons(IPPROTO_ICMPV6); // Needed?
-
-    if ((len = read(_ifd, (struct sockaddr* )&t_saddr, sizeof(struct sockaddr_in6), msg, sizeof(msg))) < 0) {
-        logger::warning() << "iface::read_advert() failed: " << logger::err();
-        return -1;
-    }
+    uint8_t buf[SOLICIT_SIZE];
+    address daddr;
 
-    saddr = t_saddr.sin6_addr;
-    
-    // Ignore packets sent from this machine
-    if (iface::is_local(saddr) == true) {
-        return 0;
-    }
+    build_solicit(buf, taddr, daddr);
 
-    if (((struct icmp6_hdr* )msg)->icmp6_type != ND_NEIGHBOR_ADVERT)
-        return -1;
+    DEBUG_LOG() << "iface::write_solicit() taddr=" << taddr
+                    << ", daddr=" << daddr;
 
-    taddr = ((struct nd_neighbor_solicit* )msg)->nd_ns_target;
+    ssize_t len = write(_ifd, daddr, buf, SOLICIT_SIZE);
 
-    logger::debug() << "iface::read_advert() saddr=" << saddr.to_string() << ", taddr=" << taddr.to_string() << ", len=" << len;
+    _counters.add((len < 0) ? SEND_ERRORS : NS_SENT);
 
     return len;
 }
 
-bool iface::is_local(const address& addr)
+void iface::queue_solicit(const address& taddr)
 {
-    // Check if the address is for an interface we own that is attached to
-    // one of the slave interfaces    
-    for (std::list<ptr<route> >::iterator ad = address::addresses_begin(); ad != address::addresses_end(); ad++)
-    {
-        if ((*ad)->addr() == addr)
-            return true;
-    }
-    return false;
+    if (!_solicits)
+        _solicits = new std::vector<queued_solicit>();
+
+    queued_solicit qs;
+    qs.ifa   = this;
+    qs.taddr = taddr;
+
+    _solicits->push_back(qs);
 }
 
-bool iface::handle_local(const address& saddr, const address& taddr)
+bool iface::queued_before(const queued_solicit& a, const queued_solicit& b)
 {
-    // Check if the address is for an interface we own that is attached to
-    // one of the slave interfaces    
-    for (std::list<ptr<route> >::iterator ad = address::addresses_begin(); ad != address::addresses_end(); ad++)
-    {
-        if ((*ad)->addr() == taddr)
-        {
-            // Loop through all the serves that are using this iface to respond to NDP solicitation requests
-            for (std::list<weak_ptr<proxy> >::iterator pit = serves_begin(); pit != serves_end(); pit++) {
-                ptr<proxy> pr = (*pit);
-                if (!pr) continue;
-                
-                for (std::list<ptr<rule> >::iterator it = pr->rules_begin(); it != pr->rules_end(); it++) {
-                    ptr<rule> ru = *it;
-
-                    if (ru->daughter() && ru->daughter()->name() == (*ad)->ifname())
-                    {
-                        logger::debug() << "proxy::handle_solicit() found local taddr=" << taddr;
-                        write_advert(saddr, taddr, false);
-                        return true;
-                    }
-                }
-            }
-        }
-    }
-    
-    return false;
+    return (iface* )a.ifa < (iface* )b.ifa;
 }
 
-void iface::handle_reverse_advert(const address& saddr, const std::string& ifname)
+void iface::flush_solicits()
 {
-    if (!saddr.is_unicast())
+    if (!_solicits || _solicits->empty())
         return;
-    
-    logger::debug()
-        << "proxy::handle_reverse_advert()";
-    
-    // Loop through all the parents that forward new NDP soliciation requests to this interface
-    for (std::list<weak_ptr<proxy> >::iterator pit = parents_begin(); pit != parents_end(); pit++) {
-        ptr<proxy> parent = (*pit);
-        if (!parent || !parent->ifa()) {
-            continue;
-        }
-    
-        // Setup the reverse path on any proxies that are dealing
-        // with the reverse direction (this helps improve connectivity and
-        // latency in a full duplex setup)
-        for (std::list<ptr<rule> >::iterator it = parent->rules_begin(); it != parent->rules_end(); it++) {
-            ptr<rule> ru = *it;
-
-            if (ru->addr() == saddr &&
-                ru->daughter()->name() == ifname)
-            {
-                logger::debug() << " - generating artifical advertisement: " << ifname;
-                parent->handle_stateless_advert(saddr, saddr, ifname, ru->autovia());
-            }
-        }
-    }
-}
 
-void iface::fixup_pollfds()
-{
-    _pollfds.resize(_map.size()*  2);
+    // Group them by interface, keeping the order they were queued in.
+    std::stable_sort(_solicits->begin(), _solicits->end(), queued_before);
 
-    int i = 0;
+    for (size_t first = 0; first < _solicits->size(); ) {
+        const ptr<iface>& ifa = (*_solicits)[first].ifa;
+        size_t last = first;
 
-    logger::debug() << "iface::fixup_pollfds() _map.size()=" << _map.size();
+        while (last < _solicits->size() && (*_solicits)[last].ifa == ifa)
+            last++;
 
-    for (std::map<std::string, weak_ptr<iface> >::iterator it = _map.begin();
-            it != _map.end(); it++) {
-        _pollfds[i].fd      = it->second->_ifd;
-        _pollfds[i].events  = POLLIN;
-        _pollfds[i].revents = 0;
-        i++;
+        ifa->write_solicits(&(*_solicits)[first], last - first);
 
-        _pollfds[i].fd      = it->second->_pfd;
-        _pollfds[i].events  = POLLIN;
-        _pollfds[i].revents = 0;
-        i++;
+        first = last;
     }
-}
 
-void iface::cleanup()
-{
-    for (std::map<std::string, weak_ptr<iface> >::iterator it = _map.begin();
-            it != _map.end(); ) {
-        std::map<std::string, weak_ptr<iface> >::iterator c_it = it++;
-        if (!c_it->second) {
-            _map.erase(c_it);
-        }
-    }
+    _solicits->clear();
 }
 
-int iface::poll_all()
+int iface::write_solicits(const queued_solicit* qs, size_t size)
 {
-    if (_map_dirty) {
-        cleanup();
-        fixup_pollfds();
-        _map_dirty = false;
-    }
+    DEBUG_LOG() << "iface::write_solicits() ifa=" << name() << ", count=" << (int)size;
 
-    if (_pollfds.size() == 0) {
-        ::sleep(1);
-        return 0;
-    }
+    int sent = 0;
 
-    assert(_pollfds.size() == _map.size()*  2);
+    for (size_t first = 0; first < size; ) {
+        int count = 0;
 
-    int len;
+        for (; count < SEND_BATCH && first + count < size; count++) {
+            address daddr;
 
-    if ((len = ::poll(&_pollfds[0], _pollfds.size(), 50)) < 0) {
-        logger::error() << "Failed to poll interfaces: " << logger::err();
-        return -1;
-    }
+            build_solicit(_send_bufs[count], qs[first + count].taddr, daddr);
 
-    if (len == 0) {
-        return 0;
-    }
+            memset(&_send_addrs[count], 0, sizeof(struct sockaddr_in6));
+            _send_addrs[count].sin6_family = AF_INET6;
+            _send_addrs[count].sin6_port   = htons(IPPROTO_ICMPV6);
+            memcpy(&_send_addrs[count].sin6_addr, &daddr.const_addr(), sizeof(struct in6_addr));
 
-    std::map<std::string, weak_ptr<iface> >::iterator i_it = _map.begin();
+            _send_iovs[count].iov_base = _send_bufs[count];
+            _send_iovs[count].iov_len  = SOLICIT_SIZE;
 
-    int i = 0;
+            memset(&_send_hdrs[count], 0, sizeof(struct mmsghdr));
+            _send_hdrs[count].msg_hdr.msg_name    = &_send_addrs[count];
+            _send_hdrs[count].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+            _send_hdrs[count].msg_hdr.msg_iov     = &_send_iovs[count];
+            _send_hdrs[count].msg_hdr.msg_iovlen  = 1;
+        }
 
-    for (std::vector<struct pollfd>::iterator f_it = _pollfds.begin();
-            f_it != _pollfds.end(); f_it++) {
-        assert(i_it != _map.end());
+        int len;
 
-        if (i && !(i % 2)) {
-            i_it++;
-        }
+        if ((len = sendmmsg(_ifd, _send_hdrs, count, 0)) <= 0) {
+            logger::error() << "iface::write_solicits() failed! error=" << logger::syserr << ", ifa=" << name()
+                            << ", taddr=" << qs[first].taddr;
 
-        bool is_pfd = i++ % 2;
+            _counters.add(SEND_ERRORS);
 
-        if (!(f_it->revents & POLLIN)) {
-            continue;
+            // Skip the message that failed and carry on with the rest.
+            len = 1;
+        } else {
+            sent += len;
         }
 
-        ptr<iface> ifa = i_it->second;
+        first += len;
+    }
 
-        address saddr, daddr, taddr;
-        ssize_t size;
+    _counters.add(NS_SENT, sent);
 
-        if (is_pfd) {
-            size = ifa->read_solicit(saddr, daddr, taddr);
-            if (size < 0) {
-                logger::error() << "Failed to read from interface '%s'", ifa->_name.c_str();
-                continue;
-            } 
-            if (size == 0) {
-                logger::debug() << "iface::read_solicit() loopback received and ignored";
-                continue;
-            }
-            
-            // Process any local addresses for interfaces that we are proxying
-            if (ifa->handle_local(saddr, taddr) == true) {
-                continue;
-            }
-            
-            // We have to handle all the parents who may be interested in
-            // the reverse path towards the one who sent this solicit.
-            // In fact, the parent need to know the source address in order
-            // to respond to NDP Solicitations
-            ifa->handle_reverse_advert(saddr, ifa->name());
-
-            // Loop through all the proxies that are using this iface to respond to NDP solicitation requests
-            bool handled = false;
-            for (std::list<weak_ptr<proxy> >::iterator pit = ifa->serves_begin(); pit != ifa->serves_end(); pit++) {
-                ptr<proxy> pr = (*pit);
-                if (!pr) continue;
-                
-                // Process the solicitation request by relating it to other
-                // interfaces or lookup up any statics routes we have configured
-                handled = true;
-                pr->handle_solicit(saddr, taddr, ifa->name());
-            }
-            
-            // If it was not handled then write an error message
-            if (handled == false) {
-                logger::debug() << " - solicit was ignored";
-            }
-            
+    return sent;
+}
+
+size_t iface::build_advert(uint8_t* buf, const address& taddr, bool router, bool solicited)
+{
+    memcpy(buf, _advert_tmpl[(router ? 2 : 0) | (solicited ? 1 : 0)], ADVERT_SIZE);
+
+    memcpy(&((struct nd_neighbor_advert* )buf)->nd_na_target, &taddr.const_addr(), sizeof(struct in6_addr));
+
+    return ADVERT_SIZE;
+}
+
+bool iface::write_advert_xsk(const address& daddr, const address& taddr, bool router)
+{
+    const struct ether_header* req_eh = (const struct ether_header* )_xsk_frame;
+
+    if (daddr != _xsk_src)
+        return false;
+
+    uint8_t frame[ETH_HLEN + sizeof(struct ip6_hdr) + ADVERT_SIZE];
+
+    struct ether_header* eh = (struct ether_header* )frame;
+    struct ip6_hdr* ip6h    = (struct ip6_hdr* )(frame + ETH_HLEN);
+    uint8_t* msg            = frame + ETH_HLEN + sizeof(struct ip6_hdr);
+
+    memcpy(eh->ether_dhost, req_eh->ether_shost, ETH_ALEN);
+    memcpy(eh->ether_shost, &hwaddr, ETH_ALEN);
+    eh->ether_type = htons(ETHERTYPE_IPV6);
+
+    // There's no kernel to pick a source address for us here, so answer on
+    // behalf of the target itself.
+    memset(ip6h, 0, sizeof(struct ip6_hdr));
+    ip6h->ip6_flow = htonl(6 << 28);
+    ip6h->ip6_plen = htons(ADVERT_SIZE);
+    ip6h->ip6_nxt  = IPPROTO_ICMPV6;
+    ip6h->ip6_hlim = 255;
+    ip6h->ip6_src  = taddr.const_addr();
+    ip6h->ip6_dst  = daddr.const_addr();
+
+    build_advert(msg, taddr, router, !daddr.is_multicast());
+
+    ((struct icmp6_hdr* )msg)->icmp6_cksum = icmp6_checksum((const uint8_t* )&ip6h->ip6_src, msg, ADVERT_SIZE);
+
+    return _xsk->transmit(frame, sizeof(frame));
+}
+
+bool iface::offload_advert(const address& taddr, bool router)
+{
+    if (!_xsk)
+        return false;
+
+    // The XDP program only ever answers unicast solicitations.
+    uint32_t flags = ND_NA_FLAG_SOLICITED | (router ? ND_NA_FLAG_ROUTER : 0);
+
+    DEBUG_LOG() << "iface::offload_advert() taddr=" << taddr;
+
+    return _xsk->add_answer(taddr, hwaddr, *(uint8_t* )&flags);
+}
+
+void iface::withdraw_advert(const address& taddr)
+{
+    if (!_xsk)
+        return;
+
+    DEBUG_LOG() << "iface::withdraw_advert() taddr=" << taddr;
+
+    _xsk->remove_answer(taddr);
+}
+
+bool iface::offload_hit(const address& taddr)
+{
+    return _xsk && _xsk->answer_hits(taddr) > 0;
+}
+
+ssize_t iface::write_advert(const address& daddr, const address& taddr, bool router)
+{
+    uint8_t buf[ADVERT_SIZE];
+
+    size_t size = build_advert(buf, taddr, router, !daddr.is_multicast());
+
+    DEBUG_LOG() << "iface::write_advert() daddr=" << daddr
+                    << ", taddr=" << taddr;
+
+    if (_xsk_frame && write_advert_xsk(daddr, taddr, router)) {
+        _counters.add(NA_SENT);
+        return size;
+    }
+
+    ssize_t len = write(_ifd, daddr, buf, size);
+
+    _counters.add((len < 0) ? SEND_ERRORS : NA_SENT);
+
+    return len;
+}
+
+int iface::write_adverts(const address* daddrs, size_t size, const address& taddr, bool router)
+{
+    // Only the solicited flag depends on the destination, so there are at
+    // most two different messages to send.
+    uint8_t bufs[2][ADVERT_SIZE];
+
+    build_advert(bufs[0], taddr, router, false);
+    build_advert(bufs[1], taddr, router, true);
+
+    DEBUG_LOG() << "iface::write_adverts() taddr=" << taddr
+                    << ", count=" << (int)size;
+
+    int sent = 0;
+
+    for (size_t first = 0; first < size; ) {
+        int count = 0;
+
+        for (; count < SEND_BATCH && first + count < size; count++) {
+            const address& daddr = daddrs[first + count];
+
+            memset(&_send_addrs[count], 0, sizeof(struct sockaddr_in6));
+            _send_addrs[count].sin6_family = AF_INET6;
+            _send_addrs[count].sin6_port   = htons(IPPROTO_ICMPV6);
+            memcpy(&_send_addrs[count].sin6_addr, &daddr.const_addr(), sizeof(struct in6_addr));
+
+            _send_iovs[count].iov_base = bufs[daddr.is_multicast() ? 0 : 1];
+            _send_iovs[count].iov_len  = ADVERT_SIZE;
+
+            memset(&_send_hdrs[count], 0, sizeof(struct mmsghdr));
+            _send_hdrs[count].msg_hdr.msg_name    = &_send_addrs[count];
+            _send_hdrs[count].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+            _send_hdrs[count].msg_hdr.msg_iov     = &_send_iovs[count];
+            _send_hdrs[count].msg_hdr.msg_iovlen  = 1;
+        }
+
+        int len;
+
+        if ((len = sendmmsg(_ifd, _send_hdrs, count, 0)) <= 0) {
+            logger::error() << "iface::write_adverts() failed! error=" << logger::syserr << ", ifa=" << name()
+                            << ", daddr=" << daddrs[first];
+
+            _counters.add(SEND_ERRORS);
+
+            // Skip the message that failed and carry on with the rest.
+            len = 1;
         } else {
-            size = ifa->read_advert(saddr, taddr);
-            if (size < 0) {
-                logger::error() << "Failed to read from interface '%s'", ifa->_name.c_str();
-                continue;
-            }
-            if (size == 0) {
-                logger::debug() << "iface::read_advert() loopback received and ignored";
-                continue;
-            }
+            sent += len;
+        }
+
+        first += len;
+    }
+
+    _counters.add(NA_SENT, sent);
+
+    return sent;
+}
+
+ssize_t iface::read_advert(int i, address& saddr, address& taddr)
+{
+    struct sockaddr_in6* t_saddr = (struct sockaddr_in6* )&_recv_addrs[i];
+    uint8_t* msg = _recv_bufs[i];
+    ssize_t len  = _recv_hdrs[i].msg_len;
+
+    int hlim = -1;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&_recv_hdrs[i].msg_hdr); cmsg;
+            cmsg = CMSG_NXTHDR(&_recv_hdrs[i].msg_hdr, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT)
+            memcpy(&hlim, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    nd_packet pkt;
+
+    if (!pkt.parse_icmp(msg, len, hlim) || pkt.type() != ND_NEIGHBOR_ADVERT)
+        return -1;
+
+    saddr = t_saddr->sin6_addr;
+    
+    // Ignore packets sent from this machine
+    if (iface::is_local(saddr) == true) {
+        return 0;
+    }
+
+    taddr = pkt.target();
+
+    DEBUG_LOG() << "iface::read_advert() saddr=" << saddr << ", taddr=" << taddr << ", len=" << len;
+
+    return len;
+}
+
+bool iface::is_local(const address& addr)
+{
+    return address::find_local(addr);
+}
+
+bool iface::handle_local(const address& saddr, const address& taddr)
+{
+    // Check if the address is for an interface we own that is attached to
+    // one of the slave interfaces    
+    std::vector<int> ifindexes;
+
+    if (!address::find_local(taddr, &ifindexes))
+        return false;
+
+    for (std::vector<int>::const_iterator ad = ifindexes.begin(); ad != ifindexes.end(); ad++)
+    {
+        char ifname[IF_NAMESIZE];
+
+        if (!if_indextoname(*ad, ifname))
+            continue;
+
+        // Loop through all the serves that are using this iface to respond to NDP solicitation requests
+        for (std::list<weak_ptr<proxy> >::iterator pit = serves_begin(); pit != serves_end(); pit++) {
+            ptr<proxy> pr = (*pit);
+            if (!pr) continue;
             
-            // Process the NDP advert
-            bool handled = false;
-            for (std::list<weak_ptr<proxy> >::iterator pit = ifa->parents_begin(); pit != ifa->parents_end(); pit++) {
-                ptr<proxy> pr = (*pit);
-                if (!pr || !pr->ifa()) {
-                    continue;
+            for (std::list<ptr<rule> >::iterator it = pr->rules_begin(); it != pr->rules_end(); it++) {
+                const ptr<rule>& ru = *it;
+
+                if (ru->daughter() && ru->daughter()->name() == ifname)
+                {
+                    DEBUG_LOG() << "proxy::handle_solicit() found local taddr=" << taddr;
+                    write_advert(saddr, taddr, false);
+                    return true;
                 }
-                
-                // The proxy must have a rule for this interface or it is not meant to receive
-                // any notifications and thus they must be ignored
-                bool autovia = false;
-                bool is_relevant = false;
-                for (std::list<ptr<rule> >::iterator it = pr->rules_begin(); it != pr->rules_end(); it++) {
-                    ptr<rule> ru = *it;
-                    
-                    if (ru->addr() == taddr &&
-                        ru->daughter() &&
-                        ru->daughter()->name() == ifa->name())
-                    {
-                        is_relevant = true;
-                        autovia = ru->autovia();
-                        break;
-                    }
-                }
-                if (is_relevant == false) {
-                    logger::debug() << "iface::read_advert() advert is not for " << ifa->name() << "...skipping";
-                    continue;
-                }
-                
-                // Process the NDP advertisement
-                handled = true;
-                pr->handle_advert(saddr, taddr, ifa->name(), autovia);
             }
-            
-            // If it was not handled then write an error message
-            if (handled == false) {
-                logger::debug() << " - advert was ignored";
+        }
+    }
+    
+    return false;
+}
+
+void iface::handle_reverse_advert(const address& saddr, const std::string& ifname)
+{
+    if (!saddr.is_unicast())
+        return;
+    
+    DEBUG_LOG()
+        << "proxy::handle_reverse_advert()";
+    
+    // Loop through all the parents that forward new NDP soliciation requests to this interface
+    for (std::list<weak_ptr<proxy> >::iterator pit = parents_begin(); pit != parents_end(); pit++) {
+        ptr<proxy> parent = (*pit);
+        if (!parent || !parent->ifa()) {
+            continue;
+        }
+    
+        // Setup the reverse path on any proxies that are dealing
+        // with the reverse direction (this helps improve connectivity and
+        // latency in a full duplex setup)
+        const std::vector<ptr<rule> >* rules = parent->find_rules(saddr);
+        if (!rules) {
+            continue;
+        }
+
+        for (std::vector<ptr<rule> >::const_iterator it = rules->begin(); it != rules->end(); it++) {
+            const ptr<rule>& ru = *it;
+
+            if (ru->daughter() &&
+                ru->daughter()->name() == ifname)
+            {
+                DEBUG_LOG() << " - generating artifical advertisement: " << ifname;
+                parent->handle_stateless_advert(saddr, saddr, ifname, ru->autovia());
             }
         }
     }
+}
+
+bool iface::epoll_open()
+{
+    if (_epfd < 0 && (_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        logger::error() << "Failed to create epoll instance: " << logger::err();
+        return false;
+    }
+
+    if (!_my_retired)
+        _my_retired = retired(_epfd);
+
+    return true;
+}
+
+int iface::loop_fd()
+{
+    return epoll_open() ? _epfd : -1;
+}
+
+void iface::loop_fd(int epfd)
+{
+    _epfd       = epfd;
+    _my_retired = retired(epfd);
+}
+
+iface::slot_queue* iface::retired(int epfd)
+{
+    mutex_lock ml(_lock);
+
+    slot_queue*& q = _retired[epfd];
+
+    if (!q)
+        q = new slot_queue();
+
+    return q;
+}
+
+void iface::retire(event_slot* slot)
+{
+    epoll_ctl(slot->loop, EPOLL_CTL_DEL, slot->fd, NULL);
+
+    __atomic_store_n(&slot->dead, true, __ATOMIC_RELEASE);
+
+    retired(slot->loop)->push(slot);
+}
+
+bool iface::epoll_add(int fd, int tag)
+{
+    if (_loop < 0) {
+        if (!epoll_open())
+            return false;
+
+        _loop = _epfd;
+    }
+
+    event_slot* slot = new event_slot();
+
+    slot->ifa     = this;
+    slot->handler = NULL;
+    slot->fd      = fd;
+    slot->tag     = tag;
+    slot->loop    = _loop;
+    slot->dead    = false;
+
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = slot;
+
+    if (epoll_ctl(_loop, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        logger::error() << "Failed to register interface '" << _name << "' with epoll: " << logger::err();
+        delete slot;
+        return false;
+    }
+
+    _slots[fd] = slot;
+
+    return true;
+}
+
+void iface::epoll_del(int fd)
+{
+    std::map<int, event_slot*>::iterator it = _slots.find(fd);
+
+    if (it == _slots.end())
+        return;
+
+    retire(it->second);
+
+    _slots.erase(it);
+}
+
+bool iface::move_to(int epfd)
+{
+    if (_loop < 0 || _loop == epfd)
+        return true;
+
+    if (!move_fd(_ifd, epfd) || !move_fd(_pfd, epfd) || !move_fd(_xsk ? _xsk->fd() : -1, epfd))
+        return false;
+
+    // The rest of the fanout group comes along, unless it's been moved
+    // elsewhere already.
+    for (size_t i = 0; i < _fanout.size(); i++) {
+        if (_fanout_loops[i] == _loop) {
+            if (!move_fd(_fanout[i], epfd))
+                return false;
+
+            _fanout_loops[i] = epfd;
+        }
+    }
+
+    _loop = epfd;
+
+    return true;
+}
+
+bool iface::move_fanout(int i, int epfd)
+{
+    if (i <= 0)
+        return move_to(epfd);
+
+    if (i > (int)_fanout.size())
+        return false;
+
+    if (!move_fd(_fanout[i - 1], epfd))
+        return false;
+
+    _fanout_loops[i - 1] = epfd;
+
+    return true;
+}
+
+bool iface::move_fd(int fd, int epfd)
+{
+    std::map<int, event_slot*>::iterator it = _slots.find(fd);
+
+    if (it == _slots.end() || it->second->loop == epfd)
+        return true;
+
+    // The old slot may still be in a batch the other loop is handling, so
+    // it gets a new one.
+    event_slot* slot = new event_slot(*it->second);
+
+    slot->loop = epfd;
+
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = slot;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        logger::error() << "Failed to move interface '" << _name << "' to another event loop: "
+                        << logger::err();
+        delete slot;
+        return false;
+    }
+
+    retire(it->second);
+
+    it->second = slot;
+
+    return true;
+}
+
+bool iface::watch(int fd, watch_handler handler, bool writable)
+{
+    if (!epoll_open())
+        return false;
+
+    event_slot* slot = new event_slot();
+
+    slot->handler = handler;
+    slot->fd      = fd;
+    slot->tag     = EV_WATCH;
+    slot->loop    = _epfd;
+    slot->dead    = false;
+
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = writable ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = slot;
+
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        logger::error() << "Failed to register fd " << fd << " with epoll: " << logger::err();
+        delete slot;
+        return false;
+    }
+
+    mutex_lock ml(_lock);
+
+    _watchers[fd] = slot;
+
+    return true;
+}
+
+void iface::unwatch(int fd)
+{
+    mutex_lock ml(_lock);
+
+    std::map<int, event_slot*>::iterator it = _watchers.find(fd);
+
+    if (it == _watchers.end())
+        return;
+
+    retire(it->second);
+
+    _watchers.erase(it);
+}
+
+void iface::cleanup()
+{
+    for (std::map<std::string, weak_ptr<iface> >::iterator it = _map.begin();
+            it != _map.end(); ) {
+        std::map<std::string, weak_ptr<iface> >::iterator c_it = it++;
+        if (!c_it->second) {
+            _map.erase(c_it);
+        }
+    }
+}
+
+void iface::update_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    _now = (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long iface::now()
+{
+    if (!_now)
+        update_now();
+
+    return _now;
+}
+
+int iface::poll_all(int timeout, const sigset_t* sigmask)
+{
+    if (__atomic_load_n(&_map_dirty, __ATOMIC_ACQUIRE)) {
+        mutex_lock ml(_lock);
+
+        if (_map_dirty) {
+            cleanup();
+            _map_dirty = false;
+        }
+    }
+
+    if (_epfd < 0) {
+        ::sleep(1);
+        update_now();
+        return 0;
+    }
+
+    // Whatever was retired before now can't be in the batch we're about to
+    // pick up, and the last one has been handled.
+    event_slot* slot;
+
+    while (_my_retired->pop(slot))
+        delete slot;
+
+    struct epoll_event events[64];
+
+    int len = epoll_pwait(_epfd, events, 64, timeout, sigmask);
+
+    update_now();
+
+    if (len < 0) {
+        logger::error() << "Failed to poll interfaces: " << logger::err();
+        return -1;
+    }
+
+    for (int i = 0; i < len; i++) {
+        slot = (event_slot*)events[i].data.ptr;
+
+        if (__atomic_load_n(&slot->dead, __ATOMIC_ACQUIRE))
+            continue;
+
+        if (slot->tag == EV_WATCH) {
+            slot->handler(slot->fd);
+            continue;
+        }
+
+        // The interface may have been released by another thread since.
+        ptr<iface> ifa = slot->ifa.lock();
+
+        if (!ifa)
+            continue;
+
+        switch (slot->tag) {
+        case EV_IFD:
+            ifa->process_advert();
+            break;
+
+        case EV_PFD:
+            ifa->process_solicit(slot->fd);
+            break;
+
+        case EV_XSK:
+            ifa->process_xsk();
+            break;
+        }
+    }
 
     return 0;
 }
 
+void iface::process_solicit(int fd)
+{
+    if (_ring && fd == _pfd) {
+        process_ring();
+        return;
+    }
+
+    int len = read(fd);
+
+    if (len < 0) {
+        logger::error() << "Failed to read from interface '" << _name << "'";
+        return;
+    }
+
+    for (int i = 0; i < len; i++)
+        process_solicit(_recv_bufs[i], _recv_hdrs[i].msg_len);
+}
+
+void iface::process_xsk()
+{
+    const uint8_t* frames[RECV_BATCH];
+    size_t lens[RECV_BATCH];
+
+    int len = _xsk->receive(frames, lens, RECV_BATCH);
+
+    for (int i = 0; i < len; i++) {
+        _xsk_frame = frames[i];
+        process_solicit(frames[i], lens[i]);
+    }
+
+    _xsk_frame = NULL;
+
+    _xsk->release(len);
+    _xsk->flush();
+}
+
+void iface::process_ring()
+{
+    for (;;) {
+        struct tpacket_block_desc* block =
+            (struct tpacket_block_desc* )(_ring + _ring_block * _ring_block_size);
+
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+
+        // Make sure we don't read the packets before the status.
+        __sync_synchronize();
+
+        struct tpacket3_hdr* hdr =
+            (struct tpacket3_hdr* )((uint8_t* )block + block->hdr.bh1.offset_to_first_pkt);
+
+        for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            process_solicit((uint8_t* )hdr + hdr->tp_mac, hdr->tp_snaplen);
+            hdr = (struct tpacket3_hdr* )((uint8_t* )hdr + hdr->tp_next_offset);
+        }
+
+        // Hand the block back to the kernel.
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+        _ring_block = (_ring_block + 1) % _ring_blocks;
+    }
+}
+
+bool iface::map_ring(int fd)
+{
+    int version = TPACKET_V3;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+        return false;
+
+    struct tpacket_req3 req;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_block_nr   = RING_BLOCKS;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr   = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCKS;
+
+    // Solicitations are small and usually few, so don't sit on a block
+    // waiting for it to fill up; hand it over after a millisecond.
+    req.tp_retire_blk_tov = 1;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        unmap_ring(fd);
+        return false;
+    }
+
+    size_t size = (size_t)RING_BLOCK_SIZE * RING_BLOCKS;
+
+    void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+
+    if (ring == MAP_FAILED) {
+        // MAP_LOCKED fails if we're over RLIMIT_MEMLOCK; that's fine.
+        ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (ring == MAP_FAILED) {
+        unmap_ring(fd);
+        return false;
+    }
+
+    _ring            = (uint8_t* )ring;
+    _ring_size       = size;
+    _ring_block_size = RING_BLOCK_SIZE;
+    _ring_blocks     = RING_BLOCKS;
+    _ring_block      = 0;
+
+    DEBUG_LOG() << "iface::map_ring() mapped " << size << " bytes on interface '" << _name << "'";
+
+    return true;
+}
+
+void iface::unmap_ring(int fd)
+{
+    // Take the ring off the socket again; otherwise the kernel keeps
+    // filling it and regular reads never see a packet.
+
+    struct tpacket_req3 req;
+
+    memset(&req, 0, sizeof(req));
+    setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+
+    int version = TPACKET_V1;
+
+    setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+}
+
+void iface::process_solicit(const uint8_t* msg, ssize_t len)
+{
+    address saddr, daddr, taddr;
+    ssize_t size;
+
+    size = read_solicit(msg, len, saddr, daddr, taddr);
+    if (size < 0) {
+        DEBUG_LOG() << "iface::read_solicit() invalid packet ignored";
+        _counters.add(MALFORMED);
+        return;
+    }
+    if (size == 0) {
+        DEBUG_LOG() << "iface::read_solicit() loopback received and ignored";
+        return;
+    }
+
+    _counters.add(NS_RECEIVED);
+
+    if (_xsk_frame)
+        _xsk_src = saddr;
+
+    // Process any local addresses for interfaces that we are proxying
+    if (handle_local(saddr, taddr) == true) {
+        _counters.add(LOCAL_ANSWERS);
+        return;
+    }
+
+    // We have to handle all the parents who may be interested in
+    // the reverse path towards the one who sent this solicit.
+    // In fact, the parent need to know the source address in order
+    // to respond to NDP Solicitations
+    handle_reverse_advert(saddr, _name);
+
+    // Loop through all the proxies that are using this iface to respond to NDP solicitation requests
+    bool handled = false;
+    for (std::list<weak_ptr<proxy> >::iterator pit = serves_begin(); pit != serves_end(); pit++) {
+        ptr<proxy> pr = (*pit);
+        if (!pr) continue;
+
+        // Process the solicitation request by relating it to other
+        // interfaces or lookup up any statics routes we have configured
+        handled = true;
+        pr->handle_solicit(saddr, taddr, _name);
+    }
+
+    // If it was not handled then write an error message
+    if (handled == false) {
+        DEBUG_LOG() << " - solicit was ignored";
+    }
+}
+
+void iface::process_advert()
+{
+    int len = read(_ifd);
+
+    if (len < 0) {
+        logger::error() << "Failed to read from interface '" << _name << "'";
+        return;
+    }
+
+    for (int i = 0; i < len; i++)
+        process_advert(i);
+}
+
+void iface::process_advert(int i)
+{
+    address saddr, taddr;
+    ssize_t size;
+
+    size = read_advert(i, saddr, taddr);
+    if (size < 0) {
+        DEBUG_LOG() << "iface::read_advert() invalid packet ignored";
+        _counters.add(MALFORMED);
+        return;
+    }
+    if (size == 0) {
+        DEBUG_LOG() << "iface::read_advert() loopback received and ignored";
+        return;
+    }
+
+    _counters.add(NA_RECEIVED);
+
+    // Process the NDP advert
+    bool handled = false;
+    for (std::list<weak_ptr<proxy> >::iterator pit = parents_begin(); pit != parents_end(); pit++) {
+        ptr<proxy> pr = (*pit);
+        if (!pr || !pr->ifa()) {
+            continue;
+        }
+
+        // The proxy must have a rule for this interface or it is not meant to receive
+        // any notifications and thus they must be ignored
+        bool autovia = false;
+        bool is_relevant = false;
+        const std::vector<ptr<rule> >* rules = pr->find_rules(taddr);
+        if (rules) {
+            for (std::vector<ptr<rule> >::const_iterator it = rules->begin(); it != rules->end(); it++) {
+                const ptr<rule>& ru = *it;
+
+                if (ru->daughter() &&
+                    ru->daughter()->name() == _name)
+                {
+                    is_relevant = true;
+                    autovia = ru->autovia();
+                    break;
+                }
+            }
+        }
+        if (is_relevant == false) {
+            DEBUG_LOG() << "iface::read_advert() advert is not for " << _name << "...skipping";
+            continue;
+        }
+
+        // Process the NDP advertisement
+        handled = true;
+        pr->handle_advert(saddr, taddr, _name, autovia);
+    }
+
+    // If it was not handled then write an error message
+    if (handled == false) {
+        DEBUG_LOG() << " - advert was ignored";
+    }
+}
+
 int iface::allmulti(int state)
 {
     struct ifreq ifr;
 
-    logger::debug()
+    DEBUG_LOG()
         << "iface::allmulti() state="
         << state << ", _name=\"" << _name << "\"";
 
@@ -793,7 +1638,7 @@ int iface::promiscuous(int state)
 {
     struct ifreq ifr;
 
-    logger::debug()
+    DEBUG_LOG()
         << "iface::promiscuous() state="
         << state << ", _name=\"" << _name << "\"";
 
@@ -833,6 +1678,11 @@ const std::string& iface::name() const
     return _name;
 }
 
+const counter_block<iface::COUNTERS>& iface::counters() const
+{
+    return _counters;
+}
+
 void iface::add_serves(const ptr<proxy>& pr)
 {
     _serves.push_back(pr);
@@ -20,17 +20,24 @@
 #include <vector>
 #include <map>
 
-#include <sys/poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/icmp6.h>
 #include <net/ethernet.h>
 
 #include "ndppd.h"
+#include "mutex.h"
+#include "mpsc_queue.h"
+#include "counter.h"
 
 NDPPD_NS_BEGIN
 
 class session;
 class proxy;
+class xsk;
+class stats;
 
-class iface {
+class iface : public ptr_object {
 public:
 
     // Destructor.
@@ -38,25 +45,101 @@ public:
 
     static ptr<iface> open_ifd(const std::string& name);
 
-    static ptr<iface> open_pfd(const std::string& name, bool promiscuous);
+    // Opens the socket used to pick up NB_NEIGHBOR_SOLICIT messages. With
+    // 'rx_ring', they're read straight out of a memory-mapped TPACKET_V3
+    // ring rather than copied out of the socket one batch at a time. With
+    // 'xdp', an XDP program steers them into an AF_XDP socket instead, and
+    // the replies go back out the same way.
+    static ptr<iface> open_pfd(const std::string& name, bool promiscuous, bool rx_ring = false,
+                               bool xdp = false);
 
-    static int poll_all();
+    // Waits up to 'timeout' milliseconds (-1 for no limit) for traffic on
+    // any of the interfaces registered with the calling thread's event loop,
+    // and dispatches it. 'sigmask' is installed for the duration of the
+    // wait, see epoll_pwait(2).
+    static int poll_all(int timeout, const sigset_t* sigmask = NULL);
 
-    ssize_t read(int fd, struct sockaddr* saddr, ssize_t saddr_size, uint8_t* msg, size_t size);
+    // Returns the epoll instance of the calling thread's event loop,
+    // creating it if needed, or -1 on error.
+    static int loop_fd();
+
+    // Makes 'epfd' the event loop of the calling thread.
+    static void loop_fd(int epfd);
+
+    // Moves the sockets of this interface over to the event loop 'epfd', so
+    // that whichever thread polls that one handles them from now on.
+    bool move_to(int epfd);
+
+    // Spreads the solicitations picked up on this interface over 'count'
+    // packet sockets, _pfd being the first, by their target address; see
+    // fanout_index(). Returns false if that isn't possible.
+    bool fanout(int count);
+
+    // Returns the number of sockets solicitations are spread over.
+    int fanout() const;
+
+    // Returns which of 'count' sockets solicitations for 'taddr' go to.
+    static int fanout_index(const address& taddr, int count);
+
+    // Moves socket 'i' of the fanout group over to the event loop 'epfd'.
+    // Socket 0 is _pfd, which goes along with all the others; see move_to().
+    bool move_fanout(int i, int epfd);
+
+    // Returns the time of the last wakeup of the calling thread in
+    // milliseconds, taken from a monotonic clock.
+    static long long now();
+
+    typedef void (*watch_handler)(int fd);
+
+    // Registers a socket other than those of an interface with the event
+    // loop; 'handler' is called whenever 'fd' becomes readable, or writable
+    // if 'writable' is set.
+    static bool watch(int fd, watch_handler handler, bool writable = false);
+
+    static void unwatch(int fd);
+
+    // Reads as many packets from 'fd' as the receive ring can hold.
+    // Returns the number of packets read, or -1 on error.
+    int read(int fd);
 
     ssize_t write(int fd, const address& daddr, const uint8_t* msg, size_t size);
 
     // Writes a NB_NEIGHBOR_SOLICIT message to the _ifd socket.
     ssize_t write_solicit(const address& taddr);
 
+    // Queues a NB_NEIGHBOR_SOLICIT message for 'taddr', to be written by
+    // the next flush_solicits() of the calling thread.
+    void queue_solicit(const address& taddr);
+
+    // Writes the solicitations queued by the calling thread, with one
+    // sendmmsg() per interface and SEND_BATCH messages.
+    static void flush_solicits();
+
     // Writes a NB_NEIGHBOR_ADVERT message to the _ifd socket;
     ssize_t write_advert(const address& daddr, const address& taddr, bool router);
 
-    // Reads a NB_NEIGHBOR_SOLICIT message from the _pfd socket.
-    ssize_t read_solicit(address& saddr, address& daddr, address& taddr);
+    // Writes the NB_NEIGHBOR_ADVERT message for 'taddr' to each of the 'size'
+    // addresses in 'daddrs', using as few system calls as possible. Returns
+    // the number of messages sent.
+    int write_adverts(const address* daddrs, size_t size, const address& taddr, bool router);
+
+    // Has the XDP program answer solicitations for 'taddr' by itself from
+    // now on. Returns false if there's no XDP program on this interface.
+    bool offload_advert(const address& taddr, bool router);
+
+    void withdraw_advert(const address& taddr);
+
+    // Returns true if the XDP program has answered solicitations for
+    // 'taddr' since the last call.
+    bool offload_hit(const address& taddr);
+
+    // Parses the NB_NEIGHBOR_SOLICIT message 'msg', as read from the _pfd
+    // socket (including the ethernet header). Returns -1 if it's malformed.
+    ssize_t read_solicit(const uint8_t* msg, ssize_t len, address& saddr, address& daddr, address& taddr);
 
-    // Reads a NB_NEIGHBOR_ADVERT message from the _ifd socket;
-    ssize_t read_advert(address& saddr, address& taddr);
+    // Parses the NB_NEIGHBOR_ADVERT message in slot 'i' of the receive
+    // ring, as read from the _ifd socket. Returns -1 if it's malformed.
+    ssize_t read_advert(int i, address& saddr, address& taddr);
     
     bool handle_local(const address& saddr, const address& taddr);
     
@@ -66,6 +149,21 @@ public:
 
     // Returns the name of the interface.
     const std::string& name() const;
+
+    enum {
+        NS_RECEIVED,
+        NA_RECEIVED,
+        NS_SENT,
+        NA_SENT,
+        MALFORMED,
+        LOCAL_ANSWERS,
+        SEND_ERRORS,
+        COUNTERS
+    };
+
+    static const counter_info counter_infos[COUNTERS];
+
+    const counter_block<COUNTERS>& counters() const;
     
     std::list<weak_ptr<proxy> >::iterator serves_begin();
     
@@ -82,19 +180,188 @@ public:
     static std::map<std::string, weak_ptr<iface> > _map;
 
 private:
+    // Takes _lock to walk _map.
+    friend class stats;
 
     static bool _map_dirty;
 
-    // An array of objects used with ::poll.
-    static std::vector<struct pollfd> _pollfds;
+    // Guards _map, _watchers and _retired, which are shared by all threads.
+    // Dispatching events doesn't need it.
+    static mutex _lock;
+
+    // The epoll instance of this thread's event loop.
+    static __thread int _epfd;
+
+    // What the event data of each registered socket points at. A slot is
+    // only freed by the thread polling the loop it was registered with,
+    // between two batches, so that an event that's already been picked up
+    // still points at something when it's handled.
+    struct event_slot {
+        // The interface the socket belongs to, or the handler of a
+        // watch()ed one.
+        weak_ptr<iface> ifa;
+
+        watch_handler handler;
+
+        int fd;
+
+        int tag;
+
+        // The epoll instance the socket is registered with.
+        int loop;
+
+        // Set once the socket has been taken off the loop.
+        bool dead;
+    };
+
+    typedef mpsc_queue<event_slot*> slot_queue;
+
+    // The slots each event loop has yet to free, by epoll instance.
+    static std::map<int, slot_queue*> _retired;
+
+    // The one of this thread's event loop.
+    static __thread slot_queue* _my_retired;
+
+    static std::map<int, event_slot*> _watchers;
+
+    static bool epoll_open();
+
+    // Returns the queue of slots to be freed by the loop 'epfd'.
+    static slot_queue* retired(int epfd);
+
+    // Takes the socket of 'slot' off its loop, and has that loop free the
+    // slot.
+    static void retire(event_slot* slot);
+
+    static __thread long long _now;
+
+    // Number of packets picked up from a socket each time it's readable.
+    static const int RECV_BATCH = 32;
+
+    // The receive ring, shared by all interfaces of a thread and filled by
+    // read().
+    static __thread struct mmsghdr _recv_hdrs[RECV_BATCH];
+
+    static __thread struct iovec _recv_iovs[RECV_BATCH];
+
+    static __thread struct sockaddr_storage _recv_addrs[RECV_BATCH];
+
+    static __thread uint8_t _recv_bufs[RECV_BATCH][256];
+
+    // Room for the IPV6_HOPLIMIT control message of the _ifd socket, in
+    // words to keep it aligned.
+    static const size_t RECV_CTRL_SIZE = 32;
+
+    static __thread uint64_t _recv_ctrl[RECV_BATCH][RECV_CTRL_SIZE / sizeof(uint64_t)];
+
+    // Layout of the rx-ring: 8 blocks of 64 KiB, in 2 KiB frames.
+    static const int RING_BLOCK_SIZE = 1 << 16;
+
+    static const int RING_BLOCKS = 8;
 
-    // Updates the array above.
-    static void fixup_pollfds();
+    static const int RING_FRAME_SIZE = 1 << 11;
+
+    // Number of messages handed to each sendmmsg() by write_adverts() and
+    // write_solicits().
+    static const int SEND_BATCH = 64;
+
+    static __thread struct mmsghdr _send_hdrs[SEND_BATCH];
+
+    static __thread struct iovec _send_iovs[SEND_BATCH];
+
+    static __thread struct sockaddr_in6 _send_addrs[SEND_BATCH];
+
+    // Size of the messages built by build_solicit().
+    static const size_t SOLICIT_SIZE = sizeof(struct nd_neighbor_solicit) + sizeof(struct nd_opt_hdr) + 6;
+
+    static __thread uint8_t _send_bufs[SEND_BATCH][SOLICIT_SIZE];
+
+    struct queued_solicit {
+        ptr<iface> ifa;
+
+        address taddr;
+    };
+
+    // The solicitations queued by this thread. Never freed, like the
+    // session timers.
+    static __thread std::vector<queued_solicit>* _solicits;
+
+    static bool queued_before(const queued_solicit& a, const queued_solicit& b);
+
+    // Writes the 'size' solicitations in 'qs' to the _ifd socket. Returns the
+    // number of messages sent.
+    int write_solicits(const queued_solicit* qs, size_t size);
+
+    // Builds a NB_NEIGHBOR_SOLICIT message for 'taddr' in 'buf', which must
+    // hold at least SOLICIT_SIZE bytes, and sets 'daddr' to the
+    // solicited-node address it goes to. Returns the size of the message.
+    // Only the target is filled in; the rest comes from _solicit_tmpl.
+    size_t build_solicit(uint8_t* buf, const address& taddr, address& daddr);
+
+    // Size of the messages built by build_advert().
+    static const size_t ADVERT_SIZE = sizeof(struct nd_neighbor_advert) + sizeof(struct nd_opt_hdr) + 6;
+
+    // Builds a NB_NEIGHBOR_ADVERT message for 'taddr' in 'buf', which must
+    // hold at least ADVERT_SIZE bytes, from one of the _advert_tmpl.
+    // Returns the size of the message.
+    size_t build_advert(uint8_t* buf, const address& taddr, bool router, bool solicited);
+
+    // Fills in _solicit_tmpl and _advert_tmpl, once hwaddr is known.
+    void build_templates();
+
+    static void update_now();
 
     static void cleanup();
 
-    // Weak pointer so this object can reference itself.
-    weak_ptr<iface> _ptr;
+    // Tells which of our sockets a slot is for.
+    enum { EV_IFD = 0, EV_PFD = 1, EV_WATCH = 2, EV_XSK = 3 };
+
+    // Registers one of our sockets with _loop. The event data points at a
+    // slot holding a weak reference to us, so that an interface that's gone
+    // by the time the event is dispatched is simply skipped.
+    bool epoll_add(int fd, int tag);
+
+    void epoll_del(int fd);
+
+    // Moves 'fd' over to the event loop 'epfd'.
+    bool move_fd(int fd, int epfd);
+
+    // Binds the packet socket 'fd' to the interface 'name' and sets it up to
+    // only let solicitations through.
+    static bool setup_pfd(int fd, const std::string& name);
+
+    // Handles a readable _pfd, or _fanout, socket.
+    void process_solicit(int fd);
+
+    void process_solicit(const uint8_t* msg, ssize_t len);
+
+    // Handles all blocks of the rx-ring that the kernel has handed over.
+    void process_ring();
+
+    // Sets up a TPACKET_V3 receive ring for 'fd'.
+    bool map_ring(int fd);
+
+    // Detaches the ring again, leaving the socket as it was.
+    static void unmap_ring(int fd);
+
+    // Handles a readable AF_XDP socket.
+    void process_xsk();
+
+    // Sends the NB_NEIGHBOR_ADVERT straight back out the AF_XDP socket, if
+    // it's a reply to the solicitation currently being handled.
+    bool write_advert_xsk(const address& daddr, const address& taddr, bool router);
+
+    // Handles a readable _ifd socket.
+    void process_advert();
+
+    // Handles the packet in slot 'i' of the receive ring.
+    void process_advert(int i);
+
+    // The epoll instance our sockets are registered with, or -1.
+    int _loop;
+
+    // The slots of our sockets, by fd.
+    std::map<int, event_slot*> _slots;
 
     // The "generic" ICMPv6 socket for reading/writing NB_NEIGHBOR_ADVERT
     // messages as well as writing NB_NEIGHBOR_SOLICIT messages.
@@ -104,6 +371,31 @@ private:
     // NB_NEIGHBOR_SOLICIT messages.
     int _pfd;
 
+    // The other members of _pfd's fanout group, if any, and the event loops
+    // they're registered with.
+    std::vector<int> _fanout;
+
+    std::vector<int> _fanout_loops;
+
+    // The AF_XDP socket solicitations are steered to in xdp mode.
+    ptr<xsk> _xsk;
+
+    // The frame process_xsk() is handling, if any.
+    const uint8_t* _xsk_frame;
+
+    // The source address of _xsk_frame, as read_solicit() found it.
+    address _xsk_src;
+
+    // The TPACKET_V3 ring mapped for _pfd in rx-ring mode, or NULL.
+    uint8_t* _ring;
+
+    size_t _ring_size, _ring_block_size;
+
+    int _ring_blocks;
+
+    // The block the kernel will hand over next.
+    int _ring_block;
+
     // Previous state of ALLMULTI for the interface.
     int _prev_allmulti;
     
@@ -120,6 +412,14 @@ private:
     // The link-layer address of this interface.
     struct ether_addr hwaddr;
 
+    counter_block<COUNTERS> _counters;
+
+    // The messages we send, complete but for the target. Adverts are
+    // indexed by (router << 1) | solicited.
+    uint8_t _solicit_tmpl[SOLICIT_SIZE];
+
+    uint8_t _advert_tmpl[4][ADVERT_SIZE];
+
     // Turns on/off ALLMULTI for this interface - returns the previous state
     // or -1 if there was an error.
     int allmulti(int state);
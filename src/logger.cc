@@ -22,11 +22,45 @@
 #include <iostream>
 #include <sstream>
 
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
 #include "ndppd.h"
 #include "logger.h"
+#include "mpsc_ring.h"
 
 NDPPD_NS_BEGIN
 
+// What each argument in a log_record is. Text is preceded by its length
+// (unsigned short); the rest are stored as they are. Arguments that don't
+// fit are left out, and text is cut short.
+enum {
+    ARG_TEXT,
+    ARG_INT,
+    ARG_ADDRESS,
+    ARG_ERRNO
+};
+
+static mpsc_ring<log_record, 512> ring;
+
+static pthread_t writer_thread;
+
+// Wakes up the writer thread.
+static int writer_fd = -1;
+
+static bool writer_running, writer_waiting, writer_stopping;
+
+// Messages dropped since the writer last said so.
+static unsigned long dropped;
+
+// The second the rate limit is counting messages for, and how many so far.
+static time_t rate_second;
+
+static int rate_count;
+
 /*const char* log::_level_str[] =
 {
     "fatal",
@@ -58,11 +92,14 @@ const logger::pri_name logger::_pri_names[] = {
 logger::logger(int pri) :
     _pri(pri), _force_log(false)
 {
+    _rec.len = 0;
 }
 
 logger::logger(const logger& l) :
-    _pri(l._pri), _ss(l._ss.str()), _force_log(false)
+    _pri(l._pri), _force_log(false)
 {
+    _rec.len = l._rec.len;
+    memcpy(_rec.data, l._rec.data, l._rec.len);
 }
 
 logger::~logger()
@@ -80,19 +117,24 @@ std::string logger::format(const std::string& fmt, ...)
     return buf;
 }
 
-std::string logger::err()
+static std::string error_string(int code)
 {
     char buf[2048];
 
 #if (_POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600) && ! _GNU_SOURCE
-    if (strerror_r(errno, buf, sizeof(buf))
+    if (strerror_r(code, buf, sizeof(buf)))
         return "Unknown error";
     return buf;
 #else
-    return strerror_r(errno, buf, sizeof(buf));
+    return strerror_r(code, buf, sizeof(buf));
 #endif
 }
 
+std::string logger::err()
+{
+    return error_string(errno);
+}
+
 logger logger::error()
 {
     return logger(LOG_ERR);
@@ -118,15 +160,55 @@ logger logger::notice()
     return logger(LOG_NOTICE);
 }
 
+void logger::put(int type, const void* data, size_t size)
+{
+    if (_rec.len + 1 + size > sizeof(_rec.data))
+        return;
+
+    _rec.data[_rec.len] = type;
+    memcpy(_rec.data + _rec.len + 1, data, size);
+    _rec.len += 1 + size;
+}
+
+void logger::put_text(const char* str, size_t size)
+{
+    size_t room = sizeof(_rec.data) - _rec.len;
+
+    if (room <= 1 + sizeof(unsigned short))
+        return;
+
+    room -= 1 + sizeof(unsigned short);
+
+    unsigned short n = (size < room) ? size : room;
+
+    _rec.data[_rec.len] = ARG_TEXT;
+    memcpy(_rec.data + _rec.len + 1, &n, sizeof(n));
+    memcpy(_rec.data + _rec.len + 1 + sizeof(n), str, n);
+    _rec.len += 1 + sizeof(n) + n;
+}
+
 logger& logger::operator<<(const std::string& str)
 {
-    _ss << str;
+    put_text(str.data(), str.size());
+    return *this;
+}
+
+logger& logger::operator<<(const char* str)
+{
+    put_text(str, strlen(str));
+    return *this;
+}
+
+logger& logger::operator<<(const address& addr)
+{
+    struct in6_addr a[2] = { addr._addr, addr._mask };
+    put(ARG_ADDRESS, a, sizeof(a));
     return *this;
 }
 
 logger& logger::operator<<(int n)
 {
-    _ss << n;
+    put(ARG_INT, &n, sizeof(n));
     return *this;
 }
 
@@ -142,6 +224,13 @@ logger& logger::endl(logger& __l)
     return __l;
 }
 
+logger& logger::syserr(logger& __l)
+{
+    int code = errno;
+    __l.put(ARG_ERRNO, &code, sizeof(code));
+    return __l;
+}
+
 logger& logger::force_log(bool b)
 {
     _force_log = b;
@@ -150,22 +239,245 @@ logger& logger::force_log(bool b)
 
 void logger::flush()
 {
-    if (!_ss.rdbuf()->in_avail())
+    if (!_rec.len)
         return;
 
-    if (!_force_log && (_pri > _max_pri))
+    if (!_force_log && (_pri > _max_pri)) {
+        _rec.len = 0;
         return;
+    }
 
+    _rec.pri = _pri;
+
+    if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        write(_rec);
+        std::cout.flush();
+    } else {
+        queue(_rec);
+    }
+
+    _rec.len = 0;
+}
+
+void logger::write(int pri, const char* msg)
+{
 #ifndef DISABLE_SYSLOG
     if (_syslog) {
-        ::syslog(_pri, "(%s) %s", _pri_names[_pri].name, _ss.str().c_str());
+        ::syslog(pri, "(%s) %s", _pri_names[pri].name, msg);
         return;
     }
 #endif
 
-    std::cout << "(" << _pri_names[_pri].name << ") " << _ss.str() << std::endl;
+    std::cout << "(" << _pri_names[pri].name << ") " << msg << "\n";
+}
+
+// Turns the arguments in 'rec' into text, and writes it out.
+void logger::write(const log_record& rec)
+{
+    std::string msg;
+
+    for (unsigned i = 0; i < rec.len; ) {
+        const char* p = rec.data + i + 1;
+
+        switch (rec.data[i]) {
+        case ARG_TEXT: {
+            unsigned short n;
+            memcpy(&n, p, sizeof(n));
+            msg.append(p + sizeof(n), n);
+            i += 1 + sizeof(n) + n;
+            break;
+        }
+
+        case ARG_INT: {
+            int n;
+            char buf[16];
+            memcpy(&n, p, sizeof(n));
+            snprintf(buf, sizeof(buf), "%d", n);
+            msg += buf;
+            i += 1 + sizeof(n);
+            break;
+        }
+
+        case ARG_ADDRESS: {
+            // Same as address::to_string().
+            struct in6_addr a[2];
+            char buf[INET6_ADDRSTRLEN + 8];
+            int pf = 0;
+
+            memcpy(a, p, sizeof(a));
+
+            if (!inet_ntop(AF_INET6, &a[0], buf, INET6_ADDRSTRLEN))
+                strcpy(buf, "::1");
+
+            while ((pf < 128) && (a[1].s6_addr[pf / 8] & (0x80 >> (pf % 8))))
+                pf++;
+
+            if (pf < 128)
+                sprintf(buf + strlen(buf), "/%d", pf);
+
+            msg += buf;
+            i += 1 + sizeof(a);
+            break;
+        }
+
+        case ARG_ERRNO: {
+            int code;
+            memcpy(&code, p, sizeof(code));
+            msg += error_string(code);
+            i += 1 + sizeof(code);
+            break;
+        }
+
+        default:
+            i = rec.len;
+        }
+    }
+
+    write(rec.pri, msg.c_str());
+}
+
+void logger::queue(const log_record& rec)
+{
+    if (rec.pri > LOG_WARNING) {
+        time_t now = time(NULL);
+
+        // Close enough if two threads start a new second at once.
+        if (now != __atomic_load_n(&rate_second, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&rate_second, now, __ATOMIC_RELAXED);
+            __atomic_store_n(&rate_count, 0, __ATOMIC_RELAXED);
+        }
+
+        if (__atomic_add_fetch(&rate_count, 1, __ATOMIC_RELAXED) > RATE_LIMIT) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    if (!ring.push(rec)) {
+        __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Pairs with the writer announcing it's about to sleep, then looking at
+    // the ring once more.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&writer_waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&writer_waiting, false, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        ::write(writer_fd, &one, sizeof(one));
+    }
+}
+
+void* logger::writer(void* )
+{
+    log_record rec;
+
+    for (;;) {
+        bool any = false;
+
+        // Write out everything that's there in one go.
+        while (ring.pop(rec)) {
+            write(rec);
+            any = true;
+        }
+
+        unsigned long n = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+
+        if (n) {
+            write(LOG_WARNING, format("%lu log messages dropped", n).c_str());
+            any = true;
+        }
+
+        if (any) {
+            std::cout.flush();
+            continue;
+        }
+
+        if (__atomic_load_n(&writer_stopping, __ATOMIC_ACQUIRE))
+            break;
+
+        __atomic_store_n(&writer_waiting, true, __ATOMIC_SEQ_CST);
+
+        if (ring.pop(rec)) {
+            __atomic_store_n(&writer_waiting, false, __ATOMIC_RELAXED);
+            write(rec);
+            continue;
+        }
+
+        uint64_t val;
+
+        if (::read(writer_fd, &val, sizeof(val)) < 0 && errno != EINTR)
+            break;
+
+        __atomic_store_n(&writer_waiting, false, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+bool logger::start_writer()
+{
+    if (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
+        return true;
+
+    if ((writer_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        logger::error() << "Unable to create eventfd for the log writer: " << err();
+        return false;
+    }
+
+    writer_stopping = false;
+
+    if (pthread_create(&writer_thread, NULL, writer, NULL)) {
+        logger::error() << "Unable to start the log writer";
+        close(writer_fd);
+        writer_fd = -1;
+        return false;
+    }
+
+    __atomic_store_n(&writer_running, true, __ATOMIC_RELEASE);
+
+    // Whatever way we end up exiting.
+    static bool registered = false;
+
+    if (!registered) {
+        atexit(stop_writer);
+        registered = true;
+    }
+
+    return true;
+}
+
+void logger::stop_writer()
+{
+    if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
+        return;
+
+    // Anything logged from here on is written right away.
+    __atomic_store_n(&writer_running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&writer_stopping, true, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    ::write(writer_fd, &one, sizeof(one));
+
+    pthread_join(writer_thread, NULL);
+
+    close(writer_fd);
+    writer_fd = -1;
+
+    // Whoever was still in the middle of queueing a message when the writer
+    // went away.
+    log_record rec;
+
+    while (ring.pop(rec))
+        write(rec);
+
+    unsigned long n = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+
+    if (n)
+        write(LOG_WARNING, format("%lu log messages dropped", n).c_str());
 
-    _ss.str("");
+    std::cout.flush();
 }
 
 #ifndef DISABLE_SYSLOG
@@ -32,6 +32,19 @@
 
 NDPPD_NS_BEGIN
 
+class address;
+
+// A message as it's handed to the writer thread: the raw arguments that
+// were passed to the logger, each behind a byte saying what it is. They
+// are only turned into text once they get there.
+struct log_record {
+    int pri;
+
+    unsigned short len;
+
+    char data[500];
+};
+
 class logger {
 public:
     logger(int pri = LOG_NOTICE);
@@ -49,13 +62,30 @@ public:
 
     void flush();
 
+    // Hands messages over to a thread of their own from now on, so that a
+    // slow syslog or terminal doesn't hold up whoever is logging. Has to be
+    // called after daemonizing, as threads don't survive fork().
+    static bool start_writer();
+
+    // Writes out whatever is still queued, and goes back to writing
+    // messages straight away.
+    static void stop_writer();
+
     static bool verbosity(const std::string& name);
 
     static int verbosity();
 
     static void verbosity(int pri);
 
+    // Returns true if messages of priority 'pri' are written.
+    static bool enabled(int pri)
+    {
+        return pri <= _max_pri;
+    }
+
     logger& operator<<(const std::string& str);
+    logger& operator<<(const char* str);
+    logger& operator<<(const address& addr);
     logger& operator<<(logger& (*pf)(logger& ));
     logger& operator<<(int n);
 
@@ -63,6 +93,10 @@ public:
 
     static logger& endl(logger& __l);
 
+    // Same as << err(), except that the message is looked up later on,
+    // rather than by whoever is logging.
+    static logger& syserr(logger& __l);
+
     // Shortcuts.
 
     static logger error();
@@ -76,7 +110,7 @@ public:
 private:
     int _pri;
 
-    std::stringstream _ss;
+    log_record _rec;
 
     bool _force_log;
 
@@ -91,7 +125,36 @@ private:
 
     static int _max_pri;
 
+    // Queued messages are dropped beyond this many per second, unless
+    // they're warnings or worse.
+    static const int RATE_LIMIT = 2000;
+
+    static void write(int pri, const char* msg);
+
+    static void write(const log_record& rec);
+
+    static void queue(const log_record& rec);
+
+    void put(int type, const void* data, size_t size);
+
+    void put_text(const char* str, size_t size);
+
+    static void* writer(void* arg);
 
 };
 
 NDPPD_NS_END
+
+// Use as DEBUG_LOG() << ...; instead of logger::debug(), so that nothing
+// after the << is evaluated, and no logger is set up, unless the message
+// is going to be written. Building with NO_DEBUG_LOG=1 leaves them out
+// altogether. It's a loop rather than an if so that it can't steal the
+// else of an if it's used in.
+#ifdef NDPPD_NO_DEBUG_LOG
+#   define DEBUG_LOG() \
+        while (false) ::ndppd::logger::debug()
+#else
+#   define DEBUG_LOG() \
+        for (bool _log = ::ndppd::logger::enabled(LOG_DEBUG); _log; _log = false) \
+            ::ndppd::logger::debug()
+#endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// A lock-free queue with any number of producers and a single consumer
+// (Vyukov's intrusive MPSC design). Pushing costs one atomic exchange and
+// never blocks; a consumer racing a producer may briefly see the queue as
+// empty, in which case the producer is expected to wake it up again.
+
+template <typename T>
+class mpsc_queue {
+public:
+    mpsc_queue() :
+        _head(&_stub), _tail(&_stub)
+    {
+        _stub.next = NULL;
+    }
+
+    ~mpsc_queue()
+    {
+        T value;
+
+        while (pop(value))
+            ;
+    }
+
+    void push(const T& value)
+    {
+        node* n  = new node();
+        n->value = value;
+        n->next  = NULL;
+
+        link(n);
+    }
+
+    // Removes the oldest value into 'value'. Returns false if there's
+    // nothing (yet) to remove. Only one thread may call this.
+    bool pop(T& value)
+    {
+        node* tail = _tail;
+        node* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+        if (tail == &_stub) {
+            if (!next)
+                return false;
+
+            _tail = next;
+            tail  = next;
+            next  = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        }
+
+        if (!next) {
+            // 'tail' is the last one; put the stub back behind it so that it
+            // can be taken out, unless a producer is halfway through a push.
+            if (tail != __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+                return false;
+
+            _stub.next = NULL;
+            link(&_stub);
+
+            next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+            if (!next)
+                return false;
+        }
+
+        _tail = next;
+        value = tail->value;
+        delete tail;
+
+        return true;
+    }
+
+private:
+    struct node {
+        node* next;
+
+        T value;
+    };
+
+    // Where producers add nodes, and where the consumer takes them from.
+    node* _head;
+
+    node* _tail;
+
+    node _stub;
+
+    void link(node* n)
+    {
+        node* prev = __atomic_exchange_n(&_head, n, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+    }
+};
+
+NDPPD_NS_END
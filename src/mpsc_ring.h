@@ -0,0 +1,99 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <stddef.h>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// A bounded lock-free queue with any number of producers and a single
+// consumer (Vyukov's bounded design). All N slots are set aside up front,
+// so pushing never allocates; it fails instead if the queue is full.
+// N must be a power of two.
+
+template <typename T, size_t N>
+class mpsc_ring {
+public:
+    mpsc_ring() :
+        _head(0), _tail(0)
+    {
+        for (size_t i = 0; i < N; i++)
+            _slots[i].seq = i;
+    }
+
+    // Adds a copy of 'value'. Returns false if there's no room.
+    bool push(const T& value)
+    {
+        size_t pos = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+
+        for (;;) {
+            slot& s    = _slots[pos & (N - 1)];
+            size_t seq = __atomic_load_n(&s.seq, __ATOMIC_ACQUIRE);
+            long diff  = (long)seq - (long)pos;
+
+            if (diff < 0)
+                return false;
+
+            if (diff > 0) {
+                pos = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            if (__atomic_compare_exchange_n(&_head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                s.value = value;
+                __atomic_store_n(&s.seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+    }
+
+    // Removes the oldest value into 'value'. Returns false if there's
+    // nothing (yet) to remove. Only one thread may call this.
+    bool pop(T& value)
+    {
+        slot& s = _slots[_tail & (N - 1)];
+
+        if (__atomic_load_n(&s.seq, __ATOMIC_ACQUIRE) != _tail + 1)
+            return false;
+
+        value = s.value;
+        __atomic_store_n(&s.seq, _tail + N, __ATOMIC_RELEASE);
+        _tail++;
+
+        return true;
+    }
+
+private:
+    struct slot {
+        // pos + 1 once the value for 'pos' is in; pos + N once it's taken.
+        size_t seq;
+
+        T value;
+    };
+
+    slot _slots[N];
+
+    // Where producers add values.
+    size_t _head;
+
+    // Where the consumer takes them from.
+    size_t _tail;
+};
+
+NDPPD_NS_END
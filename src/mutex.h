@@ -0,0 +1,79 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <pthread.h>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// A recursive mutex. It's never destroyed, since the static instances may
+// still be needed while other static objects are being torn down at exit.
+
+class mutex {
+public:
+    mutex()
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&_mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    void lock()
+    {
+        pthread_mutex_lock(&_mutex);
+    }
+
+    void unlock()
+    {
+        pthread_mutex_unlock(&_mutex);
+    }
+
+private:
+    pthread_mutex_t _mutex;
+
+    mutex(const mutex&);
+
+    mutex& operator=(const mutex&);
+};
+
+// Holds a mutex for as long as it's in scope.
+
+class mutex_lock {
+public:
+    mutex_lock(mutex& m) :
+        _mutex(m)
+    {
+        _mutex.lock();
+    }
+
+    ~mutex_lock()
+    {
+        _mutex.unlock();
+    }
+
+private:
+    mutex& _mutex;
+
+    mutex_lock(const mutex_lock&);
+
+    mutex_lock& operator=(const mutex_lock&);
+};
+
+NDPPD_NS_END
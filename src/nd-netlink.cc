@@ -48,7 +48,7 @@ void if_add_to_list(int ifindex, const ptr<iface>& ifa)
         }
     }
     if (!found) {
-        logger::debug() << "rule::add_iface() if=" << ifa->name();
+        DEBUG_LOG() << "rule::add_iface() if=" << ifa->name();
         interface anInterface;
         anInterface._name = ifa->name();
         anInterface.ifindex = ifindex;
@@ -65,7 +65,7 @@ if_addr_add(int ifindex, struct in6_addr *iaddr)
          it != interfaces.end(); it++) {
         if ((*it).ifindex == ifindex) {
             address addr = address(*iaddr);
-            logger::debug() << "Adding addr " << addr.to_string();
+            DEBUG_LOG() << "Adding addr " << addr.to_string();
             std::list<address>::iterator it_addr;
             it_addr = std::find((*it).addresses.begin(), (*it).addresses.end(), addr);
             if (it_addr == (*it).addresses.end()) {
@@ -86,7 +86,7 @@ if_addr_del(int ifindex, struct in6_addr *iaddr)
          it != interfaces.end(); it++) {
         if ((*it).ifindex == ifindex) {
             address addr = address(*iaddr);
-            logger::debug() << "Deleting addr " << addr.to_string();
+            DEBUG_LOG() << "Deleting addr " << addr.to_string();
             (*it).addresses.remove(addr);
             break;
         }
@@ -184,7 +184,7 @@ new_addr(struct nl_object *obj, void *p)
 static int
 nl_msg_handler(struct nl_msg *msg, void *arg)
 {
-    logger::debug() << "nl_msg_handler";
+    DEBUG_LOG() << "nl_msg_handler";
     struct nlmsghdr *hdr = nlmsg_hdr(msg);
 
     switch (hdr->nlmsg_type) {
@@ -0,0 +1,230 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <string.h>
+#include <cstring>
+
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+
+#include "ndppd.h"
+#include "nd_packet.h"
+
+NDPPD_NS_BEGIN
+
+// Where the fields we look at are, in the IPv6 header and in the ICMPv6
+// message. Both messages have the flags (or reserved field) and the target
+// in the same place.
+enum {
+    IP6_PLEN   = 4,
+    IP6_NXT    = 6,
+    IP6_HLIM   = 7,
+    IP6_SRC    = 8,
+    IP6_DST    = 24,
+    ND_TYPE    = 0,
+    ND_CODE    = 1,
+    ND_FLAGS   = 4,
+    ND_TARGET  = 8
+};
+
+static inline uint32_t load16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// Reads a 16-bit word wherever it is; this compiles down to a plain load.
+static inline uint16_t load_word(const uint8_t* p)
+{
+    uint16_t w;
+
+    memcpy(&w, p, sizeof(w));
+
+    return w;
+}
+
+uint16_t icmp6_checksum(const uint8_t* addrs, const uint8_t* msg, size_t len)
+{
+    uint32_t sum = 0;
+
+    // The pseudo-header: addresses, upper-layer length and next header.
+    for (int i = 0; i < 32; i += 2)
+        sum += load_word(addrs + i);
+
+    sum += htons(len);
+    sum += htons(IPPROTO_ICMPV6);
+
+    for (size_t i = 0; i + 1 < len; i += 2)
+        sum += load_word(msg + i);
+
+    if (len & 1)
+        sum += htons(msg[len - 1] << 8);
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
+nd_packet::nd_packet() :
+    _icmp(NULL), _slla(NULL), _tlla(NULL), _has_ip6(false)
+{
+}
+
+bool nd_packet::parse_frame(const uint8_t* msg, size_t len)
+{
+    _has_ip6 = false;
+
+    if (len < ETH_HLEN + sizeof(struct ip6_hdr))
+        return false;
+
+    if (load16(msg + ETH_HLEN - 2) != ETHERTYPE_IPV6)
+        return false;
+
+    const uint8_t* ip6h = msg + ETH_HLEN;
+
+    // Extension headers aren't allowed through by the socket filters.
+    if ((ip6h[0] >> 4) != 6 || ip6h[IP6_NXT] != IPPROTO_ICMPV6 || ip6h[IP6_HLIM] != 255)
+        return false;
+
+    // Short frames are padded, so it's the payload length that counts.
+    size_t plen = load16(ip6h + IP6_PLEN);
+
+    if (plen > len - ETH_HLEN - sizeof(struct ip6_hdr))
+        return false;
+
+    const uint8_t* icmp = ip6h + sizeof(struct ip6_hdr);
+
+    if (!parse(icmp, plen))
+        return false;
+
+    // Packet sockets see the message before the checksum is checked.
+    if (icmp6_checksum(ip6h + IP6_SRC, icmp, plen) != 0)
+        return false;
+
+    memcpy(&_src, ip6h + IP6_SRC, sizeof(_src));
+    memcpy(&_dst, ip6h + IP6_DST, sizeof(_dst));
+    _has_ip6 = true;
+
+    // A solicitation for duplicate address detection must go to the
+    // solicited-node address and can't carry a link-layer address.
+    if (type() == ND_NEIGHBOR_SOLICIT && IN6_IS_ADDR_UNSPECIFIED(&_src)) {
+        if (!IN6_IS_ADDR_MC_LINKLOCAL(&_dst) || _dst.s6_addr[11] != 1 ||
+            _dst.s6_addr[12] != 0xff || _slla)
+            return false;
+    }
+
+    if (type() == ND_NEIGHBOR_ADVERT && IN6_IS_ADDR_MULTICAST(&_dst) &&
+        (flags() & ND_NA_FLAG_SOLICITED))
+        return false;
+
+    return true;
+}
+
+bool nd_packet::parse_icmp(const uint8_t* msg, size_t len, int hlim)
+{
+    _has_ip6 = false;
+
+    if (hlim != 255)
+        return false;
+
+    return parse(msg, len);
+}
+
+bool nd_packet::parse(const uint8_t* msg, size_t len)
+{
+    // Both messages have a 24 byte fixed part.
+    if (len < sizeof(struct nd_neighbor_solicit))
+        return false;
+
+    _icmp = msg;
+    _slla = NULL;
+    _tlla = NULL;
+
+    if (msg[ND_TYPE] != ND_NEIGHBOR_SOLICIT && msg[ND_TYPE] != ND_NEIGHBOR_ADVERT)
+        return false;
+
+    memcpy(&_target, msg + ND_TARGET, sizeof(_target));
+
+    if (msg[ND_CODE] != 0 || IN6_IS_ADDR_MULTICAST(&_target))
+        return false;
+
+    // Options come in units of 8 bytes, and none may be empty.
+    for (size_t off = sizeof(struct nd_neighbor_solicit); off < len; ) {
+        const struct nd_opt_hdr* opt = (const struct nd_opt_hdr* )(msg + off);
+
+        if (len - off < sizeof(struct nd_opt_hdr) || !opt->nd_opt_len)
+            return false;
+
+        size_t size = opt->nd_opt_len * 8;
+
+        if (size > len - off)
+            return false;
+
+        if (opt->nd_opt_type == ND_OPT_SOURCE_LINKADDR)
+            _slla = msg + off + sizeof(struct nd_opt_hdr);
+        else if (opt->nd_opt_type == ND_OPT_TARGET_LINKADDR)
+            _tlla = msg + off + sizeof(struct nd_opt_hdr);
+
+        off += size;
+    }
+
+    return true;
+}
+
+int nd_packet::type() const
+{
+    return _icmp[ND_TYPE];
+}
+
+bool nd_packet::has_ip6() const
+{
+    return _has_ip6;
+}
+
+const struct in6_addr& nd_packet::src() const
+{
+    return _src;
+}
+
+const struct in6_addr& nd_packet::dst() const
+{
+    return _dst;
+}
+
+const struct in6_addr& nd_packet::target() const
+{
+    return _target;
+}
+
+uint32_t nd_packet::flags() const
+{
+    uint32_t flags;
+
+    memcpy(&flags, _icmp + ND_FLAGS, sizeof(flags));
+
+    return flags;
+}
+
+const uint8_t* nd_packet::slla() const
+{
+    return _slla;
+}
+
+const uint8_t* nd_packet::tlla() const
+{
+    return _tlla;
+}
+
+NDPPD_NS_END
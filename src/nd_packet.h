@@ -0,0 +1,92 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// Returns the ICMPv6 checksum of the 'len' bytes in 'msg', which are sent
+// with the source and destination addresses in the 32 bytes at 'addrs', as
+// laid out in the IPv6 header. Computed over a message whose checksum field
+// is already filled in, it's zero if that checksum is correct. Neither
+// buffer needs to be aligned.
+uint16_t icmp6_checksum(const uint8_t* addrs, const uint8_t* msg, size_t len);
+
+// A view of a Neighbor Solicitation or Advertisement message in a receive
+// buffer. Parsing checks every length it relies on, as well as the rules of
+// RFC 4861 sections 7.1.1 and 7.1.2. Only the addresses are copied out; the
+// rest is read from the buffer, which must outlive the view. Nothing in the
+// buffer is assumed to be aligned, as an ethernet header leaves the IPv6
+// header at an offset of 14 bytes.
+
+class nd_packet {
+public:
+    nd_packet();
+
+    // Parses the ethernet frame 'msg', as read from a packet socket. Returns
+    // false if it isn't a valid Neighbor Discovery message.
+    bool parse_frame(const uint8_t* msg, size_t len);
+
+    // Parses the ICMPv6 message 'msg', as read from a raw socket that has
+    // already checked the checksum, and received with the hop limit 'hlim'.
+    // Returns false if it isn't a valid Neighbor Discovery message.
+    bool parse_icmp(const uint8_t* msg, size_t len, int hlim);
+
+    // Either ND_NEIGHBOR_SOLICIT or ND_NEIGHBOR_ADVERT.
+    int type() const;
+
+    // Returns whether there was an IPv6 header, that is whether the message
+    // was read from a packet socket. Only then are the source and
+    // destination addresses set.
+    bool has_ip6() const;
+
+    const struct in6_addr& src() const;
+
+    const struct in6_addr& dst() const;
+
+    const struct in6_addr& target() const;
+
+    // Returns the flags of an advertisement, in network byte order.
+    uint32_t flags() const;
+
+    // Returns the link-layer address in the source or target link-layer
+    // address option, or NULL if there's none.
+    const uint8_t* slla() const;
+
+    const uint8_t* tlla() const;
+
+private:
+    const uint8_t* _icmp;
+
+    const uint8_t* _slla;
+
+    const uint8_t* _tlla;
+
+    bool _has_ip6;
+
+    struct in6_addr _src, _dst, _target;
+
+    bool parse(const uint8_t* msg, size_t len);
+};
+
+NDPPD_NS_END
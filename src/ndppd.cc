@@ -30,6 +30,9 @@
 
 #include "ndppd.h"
 #include "route.h"
+#include "netlink.h"
+#include "worker.h"
+#include "stats.h"
 
 using namespace ndppd;
 
@@ -146,6 +149,19 @@ static bool configure(ptr<conf>& cf)
         address::ttl(30000);
     else
         address::ttl(*x_cf);
+
+    int workers = 1;
+    if ((x_cf = cf->find("workers")))
+        workers = *x_cf;
+
+    // With a single worker, everything stays in the main loop.
+    bool pool = workers > 1;
+
+    if (pool && !worker::create(workers))
+        return false;
+
+    if ((x_cf = cf->find("stats-socket")) && !stats::open(*x_cf))
+        return false;
     
     std::list<ptr<rule> > myrules;
 
@@ -153,6 +169,8 @@ static bool configure(ptr<conf>& cf)
 
     std::vector<ptr<conf> > proxies(cf->find_all("proxy"));
 
+    bool any_xdp = false;
+
     for (p_it = proxies.begin(); p_it != proxies.end(); p_it++) {
         ptr<conf> pr_cf = *p_it;
 
@@ -166,11 +184,49 @@ static bool configure(ptr<conf>& cf)
         else
             promiscuous = *x_cf;
 
-        ptr<proxy> pr = proxy::open(*pr_cf, promiscuous);
+        bool rx_ring = false;
+        if ((x_cf = pr_cf->find("rx-ring")))
+            rx_ring = *x_cf;
+
+        bool xdp = false;
+        if ((x_cf = pr_cf->find("xdp")))
+            xdp = *x_cf;
+
+        int fanout = 1;
+        if ((x_cf = pr_cf->find("fanout")))
+            fanout = *x_cf;
+
+        if (fanout > 1 && (rx_ring || xdp)) {
+            logger::warning() << "'fanout' can't be combined with 'rx-ring' or 'xdp', ignoring it";
+            fanout = 1;
+        }
+
+        any_xdp |= xdp;
+
+        ptr<proxy> pr = proxy::open(*pr_cf, promiscuous, rx_ring, xdp);
         if (!pr || pr.is_null() == true) {
             return false;
         }
 
+        if (fanout > 1 && !pr->ifa()->fanout(fanout))
+            logger::warning() << "Failed to spread interface '" << pr->ifa()->name() << "' over "
+                              << fanout << " sockets, using just the one";
+
+        // Each socket of the fanout group gets a worker of its own, along
+        // with the sessions its solicitations are for.
+        std::vector<worker*> owners(pr->ifa()->fanout(), (worker*)NULL);
+
+        if (pool) {
+            for (size_t i = 0; i < owners.size(); i++) {
+                owners[i] = worker::assign();
+
+                if (!owners[i]->adopt(pr->ifa(), i))
+                    return false;
+            }
+        }
+
+        pr->owners(owners);
+
         if (!(x_cf = pr_cf->find("router")))
             pr->router(true);
         else
@@ -180,6 +236,9 @@ static bool configure(ptr<conf>& cf)
             pr->autowire(false);
         else
             pr->autowire(*x_cf);
+
+        if (pr->autowire() && !netlink::open())
+            return false;
         
         if (!(x_cf = pr_cf->find("keepalive")))
             pr->keepalive(true);
@@ -206,6 +265,31 @@ static bool configure(ptr<conf>& cf)
         else
             pr->timeout(*x_cf);
 
+        if (!(x_cf = pr_cf->find("renew-window")))
+            pr->renew_window(pr->ttl() / 8);
+        else
+            pr->renew_window(*x_cf);
+
+        if (!(x_cf = pr_cf->find("renew-rate")))
+            pr->renew_rate(0);
+        else
+            pr->renew_rate(*x_cf);
+
+        if (!(x_cf = pr_cf->find("max-sessions")))
+            pr->max_sessions(0);
+        else
+            pr->max_sessions(*x_cf);
+
+        if (!(x_cf = pr_cf->find("session-rate")))
+            pr->session_rate(0);
+        else
+            pr->session_rate(*x_cf);
+
+        if (!(x_cf = pr_cf->find("negative-cache")))
+            pr->negative_cache_size(0);
+        else
+            pr->negative_cache_size(*x_cf);
+
         std::vector<ptr<conf> >::const_iterator r_it;
 
         std::vector<ptr<conf> > rules(pr_cf->find_all("rule"));
@@ -229,6 +313,11 @@ static bool configure(ptr<conf>& cf)
                 }
                 
                 ifa->add_parent(pr);
+
+                // Unless another proxy lives there, it may as well be polled
+                // by the worker its adverts are meant for.
+                if (pool && !worker::owner(ifa) && !owners[0]->adopt(ifa))
+                    return false;
                 
                 myrules.push_back(pr->add_rule(addr, ifa, autovia));
             } else if (ru_cf->find("auto")) {
@@ -239,44 +328,52 @@ static bool configure(ptr<conf>& cf)
         }
     }
     
+    if (rule::any_auto())
+        route::monitor();
+
+    // The XDP programs hand solicitations for our own addresses back to the
+    // kernel, so they need to know what those are.
+    if (rule::any_iface() || any_xdp)
+        address::monitor();
+
     // Print out all the topology    
     for (std::map<std::string, weak_ptr<iface> >::iterator i_it = iface::_map.begin(); i_it != iface::_map.end(); i_it++) {
         ptr<iface> ifa = i_it->second;
         
-        logger::debug() << "iface " << ifa->name() << " {";
+        DEBUG_LOG() << "iface " << ifa->name() << " {";
         
         for (std::list<weak_ptr<proxy> >::iterator pit = ifa->serves_begin(); pit != ifa->serves_end(); pit++) {
             ptr<proxy> pr = (*pit);
             if (!pr) continue;
             
-            logger::debug() << "  " << "proxy " << logger::format("%x", pr.get_pointer()) << " {";
+            DEBUG_LOG() << "  " << "proxy " << logger::format("%x", pr.get_pointer()) << " {";
             
              for (std::list<ptr<rule> >::iterator rit = pr->rules_begin(); rit != pr->rules_end(); rit++) {
                 ptr<rule> ru = *rit;
                 
-                logger::debug() << "    " << "rule " << logger::format("%x", ru.get_pointer()) << " {";
-                logger::debug() << "      " << "taddr " << ru->addr()<< ";";
+                DEBUG_LOG() << "    " << "rule " << logger::format("%x", ru.get_pointer()) << " {";
+                DEBUG_LOG() << "      " << "taddr " << ru->addr()<< ";";
                 if (ru->is_auto())
-                    logger::debug() << "      " << "auto;";
+                    DEBUG_LOG() << "      " << "auto;";
                 else if (!ru->daughter())
-                    logger::debug() << "      " << "static;";
+                    DEBUG_LOG() << "      " << "static;";
                 else
-                    logger::debug() << "      " << "iface " << ru->daughter()->name() << ";";
-                logger::debug() << "    }";
+                    DEBUG_LOG() << "      " << "iface " << ru->daughter()->name() << ";";
+                DEBUG_LOG() << "    }";
              }
             
-            logger::debug() << "  }";
+            DEBUG_LOG() << "  }";
         }
         
-        logger::debug() << "  " << "parents {";
+        DEBUG_LOG() << "  " << "parents {";
         for (std::list<weak_ptr<proxy> >::iterator pit = ifa->parents_begin(); pit != ifa->parents_end(); pit++) {
             ptr<proxy> pr = (*pit);
             
-            logger::debug() << "    " << "parent " << logger::format("%x", pr.get_pointer()) << ";";
+            DEBUG_LOG() << "    " << "parent " << logger::format("%x", pr.get_pointer()) << ";";
         }
-        logger::debug() << "  }";
+        DEBUG_LOG() << "  }";
         
-        logger::debug() << "}";
+        DEBUG_LOG() << "}";
     }
     
     return true;
@@ -284,6 +381,27 @@ static bool configure(ptr<conf>& cf)
 
 static bool running = true;
 
+// Returns how long the main loop may sleep before something needs attention:
+// a session expiring, or one of the route/address tables being reloaded.
+static int next_timeout()
+{
+    int timeout = session::next_timeout();
+
+    if (rule::any_auto()) {
+        int t = route::next_update();
+        if (t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+    }
+
+    if (rule::any_iface()) {
+        int t = address::next_update();
+        if (t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+    }
+
+    return timeout;
+}
+
 static void exit_ndppd(int sig)
 {
     logger::error() << "Shutting down...";
@@ -295,6 +413,14 @@ int main(int argc, char* argv[], char* env[])
     signal(SIGINT, exit_ndppd);
     signal(SIGTERM, exit_ndppd);
 
+    // Only let the signals through while we're waiting in iface::poll_all(),
+    // so a shutdown request can't slip in just before we go to sleep.
+    sigset_t sigmask, orig_sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGINT);
+    sigaddset(&sigmask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigmask, &orig_sigmask);
+
     std::string config_path("/etc/ndppd.conf");
     std::string pidfile;
     std::string verbosity;
@@ -368,33 +494,36 @@ int main(int argc, char* argv[], char* env[])
         pf.close();
     }
 
-    // Time stuff.
+    // From here on, logging mustn't hold up the event loops.
+    if (!logger::start_writer())
+        logger::warning() << "Writing log messages in the foreground";
 
-    struct timeval t1, t2;
+    if (!worker::start_all()) {
+        worker::stop_all();
+        return -1;
+    }
 
-    gettimeofday(&t1, 0);
+    // Time stuff.
+
+    long long t1 = iface::now();
 
 #ifdef WITH_ND_NETLINK
     netlink_setup();
 #endif
 
     while (running) {
-        if (iface::poll_all() < 0) {
+        if (iface::poll_all(next_timeout(), &orig_sigmask) < 0) {
             if (running) {
                 logger::error() << "iface::poll_all() failed";
             }
             break;
         }
 
-        int elapsed_time;
-        gettimeofday(&t2, 0);
+        long long t2 = iface::now();
 
-        elapsed_time =
-            ((t2.tv_sec  - t1.tv_sec)*   1000) +
-            ((t2.tv_usec - t1.tv_usec) / 1000);
+        int elapsed_time = (int)(t2 - t1);
 
-        t1.tv_sec  = t2.tv_sec;
-        t1.tv_usec = t2.tv_usec;
+        t1 = t2;
 
         if (rule::any_auto())
             route::update(elapsed_time);
@@ -402,15 +531,30 @@ int main(int argc, char* argv[], char* env[])
         if (rule::any_iface())
             address::update(elapsed_time);
 
-        session::update_all(elapsed_time);
+        session::update_all();
+
+        // Send the solicitations queued while handling this batch.
+        iface::flush_solicits();
+
+        // Send off any route changes made while handling this batch.
+        netlink::flush();
     }
 
+    worker::stop_all();
+
+    // Unwire while we still can.
+    proxy::clear_sessions();
+    netlink::close();
+    stats::close();
+
 #ifdef WITH_ND_NETLINK
     netlink_teardown();
 #endif
 
     logger::notice() << "Bye";
 
+    logger::stop_writer();
+
     return 0;
 }
 
@@ -0,0 +1,118 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "ndppd.h"
+#include "negative_cache.h"
+#include "address_map.h"
+#include "iface.h"
+
+NDPPD_NS_BEGIN
+
+negative_cache::negative_cache() :
+    _size(0), _count(0), _ttl(0), _current(0), _stamp(0)
+{
+}
+
+void negative_cache::reset(size_t size, int ttl)
+{
+    // With ten bits per address and seven hashes, about 1% of the lookups
+    // for addresses that were never inserted come back positive.
+    size_t words = (size * 10 + 63) / 64;
+
+    _size    = size;
+    _ttl     = ttl;
+    _count   = 0;
+    _current = 0;
+    _stamp   = 0;
+
+    for (int i = 0; i < 2; i++)
+        _bits[i].assign(words, 0);
+}
+
+bool negative_cache::enabled() const
+{
+    return _size > 0;
+}
+
+void negative_cache::rotate()
+{
+    long long now = iface::now();
+
+    if (!_stamp)
+        _stamp = now;
+
+    if (now - _stamp >= 2 * (long long)_ttl) {
+        // Both generations are out of date.
+        _bits[0].assign(_bits[0].size(), 0);
+        _bits[1].assign(_bits[1].size(), 0);
+    } else if (now - _stamp < _ttl && _count < _size) {
+        return;
+    } else {
+        _current = !_current;
+        _bits[_current].assign(_bits[_current].size(), 0);
+    }
+
+    _count = 0;
+    _stamp = now;
+}
+
+void negative_cache::insert(const address& addr)
+{
+    if (!enabled())
+        return;
+
+    rotate();
+
+    uint64_t h     = address_hash(addr.const_addr());
+    uint32_t h1    = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    size_t   nbits = _bits[_current].size() * 64;
+
+    for (int i = 0; i < HASHES; i++) {
+        size_t bit = (h1 + i * h2) % nbits;
+        _bits[_current][bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+
+    _count++;
+}
+
+bool negative_cache::contains(const address& addr)
+{
+    if (!enabled())
+        return false;
+
+    rotate();
+
+    uint64_t h     = address_hash(addr.const_addr());
+    uint32_t h1    = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    size_t   nbits = _bits[0].size() * 64;
+
+    for (int g = 0; g < 2; g++) {
+        int i;
+
+        for (i = 0; i < HASHES; i++) {
+            size_t bit = (h1 + i * h2) % nbits;
+
+            if (!(_bits[g][bit / 64] & ((uint64_t)1 << (bit % 64))))
+                break;
+        }
+
+        if (i == HASHES)
+            return true;
+    }
+
+    return false;
+}
+
+NDPPD_NS_END
@@ -0,0 +1,61 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// Remembers target addresses that recently went unanswered, using about ten
+// bits for each. It's a Bloom filter split in two generations: addresses go
+// into the current one, and lookups check both. Every 'ttl' milliseconds,
+// or once the current generation holds 'size' addresses, the older
+// generation is cleared and becomes the current one. An address is thus
+// remembered for up to twice 'ttl', but one in about a hundred of those
+// never inserted is reported as well.
+
+class negative_cache {
+public:
+    negative_cache();
+
+    // Sets the cache up for 'size' addresses per generation. A 'size' of 0
+    // disables it.
+    void reset(size_t size, int ttl);
+
+    bool enabled() const;
+
+    void insert(const address& addr);
+
+    bool contains(const address& addr);
+
+private:
+    static const int HASHES = 7;
+
+    std::vector<uint64_t> _bits[2];
+
+    size_t _size, _count;
+
+    int _ttl, _current;
+
+    long long _stamp;
+
+    void rotate();
+};
+
+NDPPD_NS_END
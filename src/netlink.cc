@@ -0,0 +1,356 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "ndppd.h"
+#include "netlink.h"
+#include "route.h"
+
+NDPPD_NS_BEGIN
+
+mutex netlink::_lock;
+
+int netlink::_fd = -1;
+
+unsigned int netlink::_seq = 0;
+
+unsigned int netlink::_groups = 0;
+
+char netlink::_tx_buf[16384];
+
+size_t netlink::_tx_len = 0;
+
+size_t netlink::_tx_count = 0;
+
+std::deque<netlink::request> netlink::_requests;
+
+bool netlink::open()
+{
+    if (_fd >= 0)
+        return true;
+
+    if ((_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE)) < 0) {
+        logger::warning() << "Unable to create netlink socket: " << logger::err();
+        return false;
+    }
+
+    struct sockaddr_nl nladdr;
+
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+
+    // Notifications come in bursts when interfaces go up or down.
+    int size = 2048000;
+
+    setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    if (bind(_fd, (struct sockaddr*)&nladdr, sizeof(nladdr)) < 0) {
+        logger::warning() << "Unable to bind netlink socket: " << logger::err();
+        close();
+        return false;
+    }
+
+    if (!iface::watch(_fd, read)) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void netlink::close()
+{
+    mutex_lock ml(_lock);
+
+    if (_fd < 0)
+        return;
+
+    flush();
+
+    iface::unwatch(_fd);
+    ::close(_fd);
+
+    _fd     = -1;
+    _groups = 0;
+
+    _requests.clear();
+}
+
+bool netlink::subscribe(int group)
+{
+    if (_fd < 0)
+        return false;
+
+    if (setsockopt(_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+        logger::warning() << "Unable to join netlink group " << group << ": " << logger::err();
+        return false;
+    }
+
+    _groups |= 1U << group;
+
+    return true;
+}
+
+bool netlink::dump(int type)
+{
+    // struct rtgenmsg is all a dump request needs, and both RTM_GETROUTE and
+    // RTM_GETADDR read the family from its first byte.
+    struct {
+        struct nlmsghdr hdr;
+        struct rtgenmsg gen;
+    } req;
+
+    mutex_lock ml(_lock);
+
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len    = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+    req.hdr.nlmsg_type   = type;
+    req.hdr.nlmsg_flags  = NLM_F_REQUEST | NLM_F_DUMP;
+    req.hdr.nlmsg_seq    = ++_seq;
+    req.gen.rtgen_family = AF_INET6;
+
+    if (send(_fd, &req, req.hdr.nlmsg_len, 0) < 0) {
+        logger::error() << "Failed to send netlink dump request: " << logger::err();
+        return false;
+    }
+
+    // Wait for the whole dump to come in.
+    int flags = fcntl(_fd, F_GETFL);
+    fcntl(_fd, F_SETFL, flags & ~O_NONBLOCK);
+
+    bool ok = receive(req.hdr.nlmsg_seq);
+
+    fcntl(_fd, F_SETFL, flags | O_NONBLOCK);
+
+    return ok;
+}
+
+void netlink::read(int /*fd*/)
+{
+    mutex_lock ml(_lock);
+
+    if (!receive(0)) {
+        logger::warning() << "Lost track of netlink updates, reloading";
+        resync();
+    }
+}
+
+bool netlink::receive(unsigned int seq)
+{
+    static char buf[32768];
+
+    for (;;) {
+        ssize_t len = recv(_fd, buf, sizeof(buf), 0);
+
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+
+            logger::error() << "Failed to read from netlink socket: " << logger::err();
+            return false;
+        }
+
+        for (struct nlmsghdr* hdr = (struct nlmsghdr*)buf; NLMSG_OK(hdr, len);
+                hdr = NLMSG_NEXT(hdr, len)) {
+            if (hdr->nlmsg_type == NLMSG_ERROR && hdr->nlmsg_seq != seq) {
+                handle_ack(hdr);
+                continue;
+            }
+
+            if (seq && hdr->nlmsg_seq == seq) {
+                if (hdr->nlmsg_type == NLMSG_DONE)
+                    return true;
+
+                if (hdr->nlmsg_type == NLMSG_ERROR) {
+                    logger::error() << "Netlink dump request failed";
+                    return false;
+                }
+            }
+
+            dispatch(hdr);
+        }
+    }
+}
+
+void netlink::dispatch(const struct nlmsghdr* hdr)
+{
+    switch (hdr->nlmsg_type) {
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE:
+        route::handle_netlink(hdr);
+        break;
+
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+        address::handle_netlink(hdr);
+        break;
+    }
+}
+
+void netlink::replace_route(const address& dst, const address& gw, const std::string& ifname)
+{
+    queue_route(RTM_NEWROUTE, dst, gw, ifname);
+}
+
+void netlink::delete_route(const address& dst, const address& gw, const std::string& ifname)
+{
+    queue_route(RTM_DELROUTE, dst, gw, ifname);
+}
+
+void netlink::queue_route(int type, const address& dst, const address& gw, const std::string& ifname)
+{
+    mutex_lock ml(_lock);
+
+    if (_fd < 0)
+        return;
+
+    int ifindex = if_nametoindex(ifname.c_str());
+
+    if (!ifindex) {
+        logger::warning() << "Unable to find interface '" << ifname << "' for route to " << dst;
+        return;
+    }
+
+    // Header, rtmsg and up to three attributes: destination, gateway, and
+    // output interface.
+    size_t size = NLMSG_SPACE(sizeof(struct rtmsg)) + 2 * RTA_SPACE(sizeof(struct in6_addr)) +
+                  RTA_SPACE(sizeof(int));
+
+    if (_tx_len + size > sizeof(_tx_buf))
+        flush();
+
+    struct nlmsghdr* hdr = (struct nlmsghdr*)(_tx_buf + _tx_len);
+
+    memset(hdr, 0, size);
+    hdr->nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
+    hdr->nlmsg_type  = type;
+    hdr->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    hdr->nlmsg_seq   = ++_seq;
+
+    struct rtmsg* rtm = (struct rtmsg*)NLMSG_DATA(hdr);
+
+    rtm->rtm_family  = AF_INET6;
+    rtm->rtm_dst_len = 128;
+    rtm->rtm_table   = RT_TABLE_MAIN;
+
+    if (type == RTM_NEWROUTE) {
+        hdr->nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+        rtm->rtm_protocol = RTPROT_BOOT;
+        rtm->rtm_scope    = RT_SCOPE_UNIVERSE;
+        rtm->rtm_type     = RTN_UNICAST;
+    } else {
+        rtm->rtm_scope    = RT_SCOPE_NOWHERE;
+    }
+
+    struct rtattr* rta = (struct rtattr*)((char*)hdr + NLMSG_ALIGN(hdr->nlmsg_len));
+
+    rta->rta_type = RTA_DST;
+    rta->rta_len  = RTA_LENGTH(sizeof(struct in6_addr));
+    memcpy(RTA_DATA(rta), &dst.const_addr(), sizeof(struct in6_addr));
+    hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+    if (!gw.is_empty()) {
+        rta = (struct rtattr*)((char*)hdr + hdr->nlmsg_len);
+        rta->rta_type = RTA_GATEWAY;
+        rta->rta_len  = RTA_LENGTH(sizeof(struct in6_addr));
+        memcpy(RTA_DATA(rta), &gw.const_addr(), sizeof(struct in6_addr));
+        hdr->nlmsg_len += RTA_ALIGN(rta->rta_len);
+    }
+
+    rta = (struct rtattr*)((char*)hdr + hdr->nlmsg_len);
+    rta->rta_type = RTA_OIF;
+    rta->rta_len  = RTA_LENGTH(sizeof(int));
+    memcpy(RTA_DATA(rta), &ifindex, sizeof(int));
+    hdr->nlmsg_len += RTA_ALIGN(rta->rta_len);
+
+    _tx_len += NLMSG_ALIGN(hdr->nlmsg_len);
+    _tx_count++;
+
+    request req;
+    req.seq  = hdr->nlmsg_seq;
+    req.type = type;
+    req.dst  = dst;
+    _requests.push_back(req);
+}
+
+void netlink::flush()
+{
+    mutex_lock ml(_lock);
+
+    if (!_tx_len)
+        return;
+
+    DEBUG_LOG() << "netlink::flush() sending " << _tx_len << " bytes";
+
+    // The kernel handles every message in the buffer before it returns, so
+    // this doesn't block for longer than it takes to update the table.
+    if (send(_fd, _tx_buf, _tx_len, 0) < 0) {
+        logger::error() << "Failed to send route updates: " << logger::err();
+
+        // None of them will be acknowledged.
+        _requests.resize(_requests.size() - _tx_count);
+    }
+
+    _tx_len   = 0;
+    _tx_count = 0;
+}
+
+void netlink::handle_ack(const struct nlmsghdr* hdr)
+{
+    const struct nlmsgerr* err = (const struct nlmsgerr*)NLMSG_DATA(hdr);
+
+    // Acknowledgements come back in the order the requests were sent, so
+    // anything older than this one has been lost.
+    while (!_requests.empty() && _requests.front().seq != hdr->nlmsg_seq)
+        _requests.pop_front();
+
+    if (_requests.empty())
+        return;
+
+    const request& req = _requests.front();
+
+    if (hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(*err)) && err->error) {
+        // It's fine for a route we're removing to be gone already.
+        if (req.type != RTM_DELROUTE || err->error != -ESRCH) {
+            logger::warning() << "Failed to " << ((req.type == RTM_NEWROUTE) ? "add" : "remove")
+                              << " route to " << req.dst << ": " << strerror(-err->error);
+        }
+    }
+
+    _requests.pop_front();
+}
+
+void netlink::resync()
+{
+    if (_groups & (1U << RTNLGRP_IPV6_ROUTE))
+        route::reload();
+
+    if (_groups & (1U << RTNLGRP_IPV6_IFADDR))
+        address::reload();
+}
+
+NDPPD_NS_END
@@ -0,0 +1,109 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <string>
+#include <deque>
+
+#include "ndppd.h"
+#include "mutex.h"
+
+NDPPD_NS_BEGIN
+
+// A single NETLINK_ROUTE socket served from the main event loop. The
+// routing table and the local address set subscribe to the groups they
+// care about, and incoming messages are handed to route::handle_netlink()
+// and address::handle_netlink().
+//
+// It's also used to program the host routes autowire sets up. Those
+// requests are queued and sent in batches by flush(); the kernel's
+// acknowledgements are picked up by the event loop like everything else.
+// Requests may be queued and flushed from any thread.
+
+class netlink {
+public:
+    // Opens the socket and registers it with iface::poll_all(). It's fine
+    // to call this more than once.
+    static bool open();
+
+    static void close();
+
+    // Joins the rtnetlink multicast group 'group' (RTNLGRP_*).
+    static bool subscribe(int group);
+
+    // Requests a dump of all AF_INET6 objects of 'type' (RTM_GETROUTE,
+    // RTM_GETADDR) and processes the replies as they come in. Doesn't
+    // return until the dump is complete.
+    static bool dump(int type);
+
+    // Queues a request to add, or replace, the host route to 'dst' through
+    // the interface 'ifname', using 'gw' as the next hop unless it's empty.
+    static void replace_route(const address& dst, const address& gw, const std::string& ifname);
+
+    // Queues a request to remove the route set up by replace_route().
+    static void delete_route(const address& dst, const address& gw, const std::string& ifname);
+
+    // Sends all queued requests.
+    static void flush();
+
+private:
+    // Guards the socket and everything queued on it.
+    static mutex _lock;
+
+    // A request that's waiting to be acknowledged.
+    struct request {
+        unsigned int seq;
+
+        int type;
+
+        address dst;
+    };
+
+    static int _fd;
+
+    static unsigned int _seq;
+
+    static char _tx_buf[16384];
+
+    static size_t _tx_len;
+
+    // Number of requests in _tx_buf.
+    static size_t _tx_count;
+
+    // Requests we've queued or sent, oldest first.
+    static std::deque<request> _requests;
+
+    static void queue_route(int type, const address& dst, const address& gw, const std::string& ifname);
+
+    static void handle_ack(const struct nlmsghdr* hdr);
+
+    // Groups we've joined, as a bit mask of 1 << RTNLGRP_*.
+    static unsigned int _groups;
+
+    static void read(int fd);
+
+    // Processes messages until the socket runs dry or, if 'seq' is
+    // nonzero, until the dump request 'seq' is complete. Returns false
+    // on errors, including messages dropped by the kernel.
+    static bool receive(unsigned int seq);
+
+    static void dispatch(const struct nlmsghdr* hdr);
+
+    // Reloads everything we're subscribed to, after we've lost track.
+    static void resync();
+};
+
+NDPPD_NS_END
@@ -0,0 +1,81 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <new>
+#include <cstddef>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// Fixed-size blocks of SIZE bytes, carved out of chunks of CHUNK blocks
+// that are never given back. Freed blocks go on a free list and are
+// handed out again first, so objects that come and go at a high rate
+// don't keep going through malloc() or fragment the heap.
+//
+// Every thread has a free list of its own, so there's no locking. A block
+// freed by another thread than the one that allocated it simply joins the
+// other thread's list.
+
+template <size_t SIZE, size_t CHUNK = 64>
+class object_pool {
+public:
+    static void* alloc()
+    {
+        if (!_free)
+            refill();
+
+        block* b = _free;
+        _free = b->next;
+
+        return b;
+    }
+
+    static void free(void* p)
+    {
+        block* b = (block*)p;
+        b->next = _free;
+        _free   = b;
+    }
+
+private:
+    union block {
+        block* next;
+
+        char data[SIZE];
+
+        // Only here to align 'data'.
+        long double align;
+    };
+
+    static __thread block* _free;
+
+    static void refill()
+    {
+        block* chunk = (block*)::operator new(CHUNK * sizeof(block));
+
+        for (size_t i = 0; i < CHUNK; i++) {
+            chunk[i].next = _free;
+            _free = &chunk[i];
+        }
+    }
+};
+
+template <size_t SIZE, size_t CHUNK>
+__thread typename object_pool<SIZE, CHUNK>::block* object_pool<SIZE, CHUNK>::_free = NULL;
+
+NDPPD_NS_END
@@ -0,0 +1,315 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// A binary trie with path compression (a Patricia trie) over IPv6
+// prefixes. Looking up an address visits at most one node per distinct
+// prefix length along its path, and returns the values stored for the
+// most specific prefix that matches. Several values may be stored for
+// the same prefix; they are kept in the order they were inserted.
+
+template <typename T>
+class prefix_trie {
+public:
+    prefix_trie() :
+        _root(-1), _free(-1)
+    {
+    }
+
+    void insert(const struct in6_addr& addr, int len, const T& value)
+    {
+        // 'link' is the index of the node whose child slot 'slot' leads to
+        // 'cur', or -1 if 'cur' is the root.
+        int link = -1, slot = 0, cur = _root;
+
+        while (cur >= 0) {
+            int n_len  = _nodes[cur].len;
+            int common = common_prefix(_nodes[cur].addr, addr, (n_len < len) ? n_len : len);
+
+            if (common < n_len) {
+                // The new prefix branches off (or ends) above 'cur', so we
+                // need a new node in between.
+                int mid;
+
+                if (common == len) {
+                    mid = create_node(addr, len);
+                    _nodes[mid].values.push_back(value);
+                } else {
+                    mid = create_node(addr, common);
+
+                    int leaf = create_node(addr, len);
+                    _nodes[leaf].values.push_back(value);
+                    attach(mid, bit(addr, common), leaf);
+                }
+
+                attach(mid, bit(_nodes[cur].addr, _nodes[mid].len), cur);
+                attach(link, slot, mid);
+                return;
+            }
+
+            if (n_len == len) {
+                _nodes[cur].values.push_back(value);
+                return;
+            }
+
+            link = cur;
+            slot = bit(addr, n_len);
+            cur  = _nodes[cur].child[slot];
+        }
+
+        int leaf = create_node(addr, len);
+        _nodes[leaf].values.push_back(value);
+        attach(link, slot, leaf);
+    }
+
+    // Removes the first value equal to 'value' stored for exactly addr/len.
+    // Returns false if there was no such value.
+    bool remove(const struct in6_addr& addr, int len, const T& value)
+    {
+        int cur = find_node(addr, len);
+
+        if (cur < 0)
+            return false;
+
+        std::vector<T>& values = _nodes[cur].values;
+
+        for (typename std::vector<T>::iterator it = values.begin(); it != values.end(); it++) {
+            if (*it == value) {
+                // Hold on to the value until the trie is consistent again.
+                T old = *it;
+                values.erase(it);
+                prune(cur);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Returns the values stored for exactly addr/len, or NULL.
+    const std::vector<T>* find_exact(const struct in6_addr& addr, int len) const
+    {
+        int cur = find_node(addr, len);
+
+        if (cur < 0 || _nodes[cur].values.empty())
+            return NULL;
+
+        return &_nodes[cur].values;
+    }
+
+    // Returns the values stored for the longest prefix matching 'addr', or
+    // NULL if nothing matches.
+    const std::vector<T>* find(const struct in6_addr& addr) const
+    {
+        const std::vector<T>* best = NULL;
+
+        for (int cur = _root; cur >= 0; ) {
+            const node& n = _nodes[cur];
+
+            if (!prefix_match(n.addr, addr, n.len))
+                break;
+
+            if (!n.values.empty())
+                best = &n.values;
+
+            if (n.len >= 128)
+                break;
+
+            cur = n.child[bit(addr, n.len)];
+        }
+
+        return best;
+    }
+
+    bool empty() const
+    {
+        return _root < 0;
+    }
+
+    void clear()
+    {
+        std::vector<node> tmp;
+        tmp.swap(_nodes);
+        _root = -1;
+        _free = -1;
+    }
+
+    void swap(prefix_trie<T>& other)
+    {
+        _nodes.swap(other._nodes);
+        std::swap(_root, other._root);
+        std::swap(_free, other._free);
+    }
+
+private:
+    struct node {
+        struct in6_addr addr;
+
+        int len;
+
+        int parent;
+
+        int child[2];
+
+        std::vector<T> values;
+    };
+
+    std::vector<node> _nodes;
+
+    int _root;
+
+    // Unused entries in _nodes, linked through 'parent'.
+    int _free;
+
+    static bool bit(const struct in6_addr& addr, int n)
+    {
+        return (addr.s6_addr[n / 8] >> (7 - (n % 8))) & 1;
+    }
+
+    static bool prefix_match(const struct in6_addr& a, const struct in6_addr& b, int len)
+    {
+        int i;
+
+        for (i = 0; len >= 32; i++, len -= 32) {
+            if (a.s6_addr32[i] != b.s6_addr32[i])
+                return false;
+        }
+
+        if (!len)
+            return true;
+
+        return !((ntohl(a.s6_addr32[i]) ^ ntohl(b.s6_addr32[i])) >> (32 - len));
+    }
+
+    static int common_prefix(const struct in6_addr& a, const struct in6_addr& b, int len)
+    {
+        for (int i = 0; i < 4; i++) {
+            uint32_t x = ntohl(a.s6_addr32[i]) ^ ntohl(b.s6_addr32[i]);
+
+            if (x) {
+                int n = i * 32 + __builtin_clz(x);
+                return (n < len) ? n : len;
+            }
+        }
+
+        return len;
+    }
+
+    int create_node(const struct in6_addr& addr, int len)
+    {
+        int i;
+
+        if (_free >= 0) {
+            i     = _free;
+            _free = _nodes[i].parent;
+        } else {
+            _nodes.push_back(node());
+            i = _nodes.size() - 1;
+        }
+
+        node& n = _nodes[i];
+
+        // Keep only the prefix bits, so that nodes can be compared as a whole.
+        n.addr = addr;
+
+        for (int b = 0; b < 16; b++) {
+            int bits = len - b * 8;
+
+            if (bits <= 0)
+                n.addr.s6_addr[b] = 0;
+            else if (bits < 8)
+                n.addr.s6_addr[b] &= 0xff << (8 - bits);
+        }
+
+        n.len      = len;
+        n.parent   = -1;
+        n.child[0] = -1;
+        n.child[1] = -1;
+
+        return i;
+    }
+
+    void free_node(int i)
+    {
+        std::vector<T> tmp;
+        tmp.swap(_nodes[i].values);
+
+        _nodes[i].parent = _free;
+        _free = i;
+    }
+
+    // Makes 'child' the child of 'link' in 'slot', or the root if 'link'
+    // is -1.
+    void attach(int link, int slot, int child)
+    {
+        if (link < 0)
+            _root = child;
+        else
+            _nodes[link].child[slot] = child;
+
+        if (child >= 0)
+            _nodes[child].parent = link;
+    }
+
+    int find_node(const struct in6_addr& addr, int len) const
+    {
+        for (int cur = _root; cur >= 0; ) {
+            const node& n = _nodes[cur];
+
+            if (n.len > len || !prefix_match(n.addr, addr, n.len))
+                return -1;
+
+            if (n.len == len)
+                return cur;
+
+            cur = n.child[bit(addr, n.len)];
+        }
+
+        return -1;
+    }
+
+    // Removes 'cur' and possibly its parent if they no longer carry any
+    // values and aren't needed to branch.
+    void prune(int cur)
+    {
+        while (cur >= 0 && _nodes[cur].values.empty()) {
+            int left   = _nodes[cur].child[0];
+            int right  = _nodes[cur].child[1];
+            int parent = _nodes[cur].parent;
+
+            if (left >= 0 && right >= 0)
+                return;
+
+            int slot = (parent >= 0 && _nodes[parent].child[1] == cur) ? 1 : 0;
+
+            attach(parent, slot, (left >= 0) ? left : right);
+            free_node(cur);
+
+            cur = parent;
+        }
+    }
+};
+
+NDPPD_NS_END
@@ -17,6 +17,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "ndppd.h"
 
 #include "proxy.h"
@@ -24,6 +26,7 @@
 #include "iface.h"
 #include "rule.h"
 #include "session.h"
+#include "worker.h"
 
 NDPPD_NS_BEGIN
         
@@ -31,8 +34,32 @@ static address all_nodes = address("ff02::1");
         
 std::list<ptr<proxy> > proxy::_list;
 
+const counter_info proxy::counter_infos[proxy::COUNTERS] = {
+    { "sessions",          "Sessions in the table", true },
+    { "sessions_created",  "Sessions set up", false },
+    { "sessions_evicted",  "Waiting or invalid sessions replaced by new ones", false },
+    { "sessions_failed",   "Sessions that got no answer", false },
+    { "rate_limited",      "Sessions not set up because of session-rate", false },
+    { "table_full",        "Sessions not set up because of max-sessions", false },
+    { "negative_hits",     "Solicitations ignored because of the negative cache", false },
+    { "retries",           "Solicitations sent again for lack of an answer", false },
+    { "renewals",          "Sessions renewed", false },
+    { "renewals_deferred", "Renewals put off because of renew-rate", false },
+    { "routes_wired",      "Routes set up by autowire", false },
+    { "routes_unwired",    "Routes removed by autowire", false }
+};
+
 proxy::proxy() :
-    _router(true), _ttl(30000), _deadtime(3000), _timeout(500), _autowire(false), _keepalive(true), _promiscuous(false), _retries(3)
+    _shards(1), _owners(1, (worker*)NULL),
+    _promiscuous(false), _router(true), _autowire(false), _retries(3), _keepalive(true),
+    _ttl(30000), _deadtime(3000), _timeout(500),
+    _max_sessions(0), _session_rate(0), _negative_cache_size(0),
+    _renew_window(3750), _renew_rate(0)
+{
+}
+
+proxy::shard::shard() :
+    idle_head(NULL), idle_tail(NULL)
 {
 }
 
@@ -41,19 +68,9 @@ ptr<proxy> proxy::find_aunt(const std::string& ifname, const address& taddr)
     for (std::list<ptr<proxy> >::iterator sit = _list.begin();
             sit != _list.end(); sit++)
     {
-        ptr<proxy> pr = (*sit);
+        const ptr<proxy>& pr = *sit;
         
-        bool has_addr = false;
-        for (std::list<ptr<rule> >::iterator it = pr->_rules.begin(); it != pr->_rules.end(); it++) {
-            ptr<rule> ru = *it;
-            
-            if (ru->addr() == taddr) {
-                has_addr = true;
-                break;
-            }
-        }
-        
-        if (has_addr == false) {
+        if (!pr->find_rules(taddr)) {
             continue;
         }
         
@@ -64,10 +81,35 @@ ptr<proxy> proxy::find_aunt(const std::string& ifname, const address& taddr)
     return ptr<proxy>();
 }
 
+void proxy::clear_sessions()
+{
+    for (std::list<ptr<proxy> >::iterator sit = _list.begin();
+            sit != _list.end(); sit++)
+    {
+        const ptr<proxy>& pr = *sit;
+
+        for (size_t i = 0; i < pr->_shards.size(); i++)
+            pr->clear_shard(pr->_shards[i]);
+    }
+}
+
+void proxy::clear_sessions(worker* owner)
+{
+    for (std::list<ptr<proxy> >::iterator sit = _list.begin();
+            sit != _list.end(); sit++)
+    {
+        const ptr<proxy>& pr = *sit;
+
+        for (size_t i = 0; i < pr->_shards.size(); i++) {
+            if (pr->_owners[i] == owner)
+                pr->clear_shard(pr->_shards[i]);
+        }
+    }
+}
+
 ptr<proxy> proxy::create(const ptr<iface>& ifa, bool promiscuous)
 {
     ptr<proxy> pr(new proxy());
-    pr->_ptr = pr;
     pr->_ifa = ifa;
     pr->_promiscuous = promiscuous;
 
@@ -75,14 +117,14 @@ ptr<proxy> proxy::create(const ptr<iface>& ifa, bool promiscuous)
 
     ifa->add_serves(pr);
 
-    logger::debug() << "proxy::create() if=" << ifa->name();
+    DEBUG_LOG() << "proxy::create() if=" << ifa->name();
 
     return pr;
 }
 
-ptr<proxy> proxy::open(const std::string& ifname, bool promiscuous)
+ptr<proxy> proxy::open(const std::string& ifname, bool promiscuous, bool rx_ring, bool xdp)
 {
-    ptr<iface> ifa = iface::open_pfd(ifname, promiscuous);
+    ptr<iface> ifa = iface::open_pfd(ifname, promiscuous, rx_ring, xdp);
 
     if (!ifa) {
         return ptr<proxy>();
@@ -91,70 +133,105 @@ ptr<proxy> proxy::open(const std::string& ifname, bool promiscuous)
     return create(ifa, promiscuous);
 }
 
-ptr<session> proxy::find_or_create_session(const address& taddr)
+ptr<session> proxy::find_or_create_session(const address& taddr, const address* saddr)
 {
-    // Let's check this proxy's list of sessions to see if we can
-    // find one with the same target address.
+    shard& sh = shard_of(taddr);
 
-    for (std::list<ptr<session> >::iterator sit = _sessions.begin();
-            sit != _sessions.end(); sit++) {
-        
-        if ((*sit)->taddr() == taddr)
-            return (*sit);
-    }
+    // Let's check this proxy's sessions to see if we can find one with
+    // the same target address.
+
+    ptr<session>* sp = sh.sessions.find(taddr.const_addr());
+
+    if (sp)
+        return *sp;
     
     ptr<session> se;
     
     // Since we couldn't find a session that matched, we'll try to find
     // a matching rule instead, and then set up a new session.
+
+    const std::vector<ptr<rule> >* rules = find_rules(taddr);
+
+    if (!rules) {
+        return se;
+    }
+
+    // Keep someone walking through a routed prefix from growing the table,
+    // and from making us flood the daughters with solicitations.
+
+    if (saddr && sh.failed.contains(taddr)) {
+        DEBUG_LOG() << "no answer for " << taddr << " lately, ignoring";
+        _counters.add(NEGATIVE_HITS);
+        return se;
+    }
+
+    if (saddr && !admit(sh, *saddr)) {
+        DEBUG_LOG() << "too many new sessions from " << *saddr << ", ignoring " << taddr;
+        _counters.add(RATE_LIMITED);
+        return se;
+    }
+
+    size_t limit = _max_sessions ? (_max_sessions + _shards.size() - 1) / _shards.size() : 0;
+
+    if (limit && sh.sessions.size() >= limit && !evict(sh)) {
+        DEBUG_LOG() << "session table is full, ignoring " << taddr;
+        _counters.add(TABLE_FULL);
+        return se;
+    }
     
-    for (std::list<ptr<rule> >::iterator it = _rules.begin();
-            it != _rules.end(); it++) {
-        ptr<rule> ru = *it;
+    for (std::vector<ptr<rule> >::const_iterator it = rules->begin();
+            it != rules->end(); it++) {
+        const ptr<rule>& ru = *it;
 
-        logger::debug() << "checking " << ru->addr() << " against " << taddr;
+        DEBUG_LOG() << "found " << ru->addr() << " for " << taddr;
 
-        if (ru->addr() == taddr) {
-            if (!se) {
-                se = session::create(_ptr, taddr, _autowire, _keepalive, _retries);
-            }
-            
-            if (ru->is_auto()) {
-                ptr<route> rt = route::find(taddr);
+        if (!se) {
+            se = session::create(this, taddr, _autowire, _keepalive, _retries);
+            _counters.add(SESSIONS_CREATED);
+        }
+        
+        if (ru->is_auto()) {
+            ptr<route> rt = route::find(taddr);
 
-                if (rt->ifname() == _ifa->name()) {
-                    logger::debug() << "skipping route since it's using interface " << rt->ifname();
-                } else {
-                    ptr<iface> ifa = rt->ifa();
+            if (!rt) {
+                DEBUG_LOG() << "no route found for " << taddr;
+            } else if (rt->ifname() == _ifa->name()) {
+                DEBUG_LOG() << "skipping route since it's using interface " << rt->ifname();
+            } else {
+                ptr<iface> ifa = rt->ifa();
 
-                    if (ifa && (ifa != ru->daughter())) {
-                        se->add_iface(ifa);
-                    }
+                if (ifa && (ifa != ru->daughter())) {
+                    se->add_iface(ifa);
                 }
-            } else if (!ru->daughter()) {
-                // This rule doesn't have an interface, and thus we'll consider
-                // it "static" and immediately send the response.
+            }
+        } else if (!ru->daughter()) {
+            // This rule doesn't have an interface, and thus we'll consider
+            // it "static" and immediately send the response.
+            se->handle_advert();
+            return se;
+            
+        } else {
+            
+            ptr<iface> ifa = ru->daughter();
+            se->add_iface(ifa);
+ 
+            #ifdef WITH_ND_NETLINK
+            if (if_addr_find(ifa->name(), &taddr.const_addr())) {
+                DEBUG_LOG() << "Sending NA out " << ifa->name();
+                se->add_iface(_ifa);
                 se->handle_advert();
-                return se;
-                
-            } else {
-                
-                ptr<iface> ifa = ru->daughter();
-                se->add_iface(ifa);
-     
-                #ifdef WITH_ND_NETLINK
-                if (if_addr_find(ifa->name(), &taddr.const_addr())) {
-                    logger::debug() << "Sending NA out " << ifa->name();
-                    se->add_iface(_ifa);
-                    se->handle_advert();
-                }
-                #endif
             }
+            #endif
         }
+
     }
     
     if (se) {
-        _sessions.push_back(se);
+        sh.sessions.insert(taddr.const_addr(), se);
+        _counters.add(SESSIONS);
+
+        if (se->status() == session::WAITING)
+            idle_link(sh, se);
     }
     
     return se;
@@ -162,22 +239,34 @@ ptr<session> proxy::find_or_create_session(const address& taddr)
 
 void proxy::handle_advert(const address& saddr, const address& taddr, const std::string& ifname, bool use_via)
 {
+    // Our sessions may only be touched by the worker they belong to.
+    worker* w = owner(taddr);
+
+    if (w != worker::current()) {
+        w->post(worker::ADVERT, this, saddr, taddr, ifname, use_via);
+        return;
+    }
+
     // If a session exists then process the advert in the context of the session
-    for (std::list<ptr<session> >::iterator s_it = _sessions.begin();
-            s_it != _sessions.end(); s_it++)
-    {
-        const ptr<session> sess = *s_it;
+    ptr<session>* sp = shard_of(taddr).sessions.find(taddr.const_addr());
 
-        if ((sess->taddr() == taddr)) {
-            sess->handle_advert(saddr, ifname, use_via);
-        }
+    if (sp) {
+        ptr<session> sess = *sp;
+        sess->handle_advert(saddr, ifname, use_via);
     }
 }
 
 void proxy::handle_stateless_advert(const address& saddr, const address& taddr, const std::string& ifname, bool use_via)
 {
-    logger::debug()
-        << "proxy::handle_stateless_advert() proxy=" << (ifa() ? ifa()->name() : "null") << ", taddr=" << taddr.to_string() << ", ifname=" << ifname;
+    worker* w = owner(taddr);
+
+    if (w != worker::current()) {
+        w->post(worker::STATELESS_ADVERT, this, saddr, taddr, ifname, use_via);
+        return;
+    }
+
+    DEBUG_LOG()
+        << "proxy::handle_stateless_advert() proxy=" << (ifa() ? ifa()->name() : "null") << ", taddr=" << taddr << ", ifname=" << ifname;
     
     ptr<session> se = find_or_create_session(taddr);
     if (!se) return;
@@ -189,12 +278,29 @@ void proxy::handle_stateless_advert(const address& saddr, const address& taddr,
 
 void proxy::handle_solicit(const address& saddr, const address& taddr, const std::string& ifname)
 {
-    logger::debug()
+    DEBUG_LOG()
         << "proxy::handle_solicit()";
+
+    // Only happens if the solicitation didn't come in where the fanout
+    // program would have put it.
+    worker* w = owner(taddr);
+
+    if (w != worker::current()) {
+        w->post(worker::SOLICIT, this, saddr, taddr, ifname);
+        return;
+    }
     
     // Otherwise find or create a session to scan for this address
-    ptr<session> se = find_or_create_session(taddr);
+    ptr<session> se = find_or_create_session(taddr, &saddr);
     if (!se) return;
+
+    // Those still waiting for an answer are the first to go once the table
+    // is full, unless someone keeps asking for them.
+    if (se->_idle) {
+        shard& sh = shard_of(taddr);
+        idle_unlink(sh, se);
+        idle_link(sh, se);
+    }
     
     // Touching the session will cause an NDP advert to be transmitted to all
     // the daughters
@@ -219,19 +325,26 @@ void proxy::handle_solicit(const address& saddr, const address& taddr, const std
 
 ptr<rule> proxy::add_rule(const address& addr, const ptr<iface>& ifa, bool autovia)
 {
-    ptr<rule> ru(rule::create(_ptr, addr, ifa));
+    ptr<rule> ru(rule::create(this, addr, ifa));
     ru->autovia(autovia);
     _rules.push_back(ru);
+    _rule_trie.insert(addr.const_addr(), addr.prefix(), ru);
     return ru;
 }
 
 ptr<rule> proxy::add_rule(const address& addr, bool aut)
 {
-    ptr<rule> ru(rule::create(_ptr, addr, aut));
+    ptr<rule> ru(rule::create(this, addr, aut));
     _rules.push_back(ru);
+    _rule_trie.insert(addr.const_addr(), addr.prefix(), ru);
     return ru;
 }
 
+const std::vector<ptr<rule> >* proxy::find_rules(const address& taddr) const
+{
+    return _rule_trie.find(taddr.const_addr());
+}
+
 std::list<ptr<rule> >::iterator proxy::rules_begin()
 {
     return _rules.begin();
@@ -244,7 +357,127 @@ std::list<ptr<rule> >::iterator proxy::rules_end()
 
 void proxy::remove_session(const ptr<session>& se)
 {
-    _sessions.remove(se);
+    erase_session(shard_of(se->taddr()), se);
+}
+
+bool proxy::fail_session(const ptr<session>& se)
+{
+    shard& sh = shard_of(se->taddr());
+
+    if (!sh.failed.enabled())
+        return false;
+
+    sh.failed.insert(se->taddr());
+    erase_session(sh, se);
+    return true;
+}
+
+void proxy::erase_session(shard& sh, const ptr<session>& se)
+{
+    ptr<session>* sp = sh.sessions.find(se->taddr().const_addr());
+
+    if (!sp || *sp != se)
+        return;
+
+    if (se->_idle)
+        idle_unlink(sh, se);
+
+    sh.sessions.erase(se->taddr().const_addr());
+    _counters.sub(SESSIONS);
+}
+
+void proxy::clear_shard(shard& sh)
+{
+    while (sh.idle_head)
+        idle_unlink(sh, sh.idle_head);
+
+    _counters.sub(SESSIONS, sh.sessions.size());
+    sh.sessions.clear();
+}
+
+void proxy::idle_link(shard& sh, session* se)
+{
+    se->_idle      = true;
+    se->_idle_prev = NULL;
+    se->_idle_next = sh.idle_head;
+
+    if (sh.idle_head)
+        sh.idle_head->_idle_prev = se;
+    else
+        sh.idle_tail = se;
+
+    sh.idle_head = se;
+}
+
+void proxy::idle_unlink(shard& sh, session* se)
+{
+    if (se->_idle_prev)
+        se->_idle_prev->_idle_next = se->_idle_next;
+    else
+        sh.idle_head = se->_idle_next;
+
+    if (se->_idle_next)
+        se->_idle_next->_idle_prev = se->_idle_prev;
+    else
+        sh.idle_tail = se->_idle_prev;
+
+    se->_idle      = false;
+    se->_idle_prev = NULL;
+    se->_idle_next = NULL;
+}
+
+bool proxy::evict(shard& sh)
+{
+    // Sessions never go back to waiting once they've become valid, so
+    // those we skip here are done with the list for good.
+    while (sh.idle_tail) {
+        ptr<session> se = sh.idle_tail;
+
+        idle_unlink(sh, se);
+
+        if (se->status() == session::WAITING || se->status() == session::INVALID) {
+            DEBUG_LOG() << "evicting session [taddr=" << se->taddr() << "]";
+            _counters.add(SESSIONS_EVICTED);
+            erase_session(sh, se);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool proxy::admit(shard& sh, const address& saddr)
+{
+    if (!_session_rate)
+        return true;
+
+    if (sh.buckets.empty()) {
+        bucket empty = { 0, 0 };
+        sh.buckets.resize(RATE_BUCKETS, empty);
+    }
+
+    // Hosts get a /64 each, and are free to pick any address within it.
+    struct in6_addr key = saddr.const_addr();
+    key.s6_addr32[2] = 0;
+    key.s6_addr32[3] = 0;
+
+    bucket& b = sh.buckets[address_hash(key) % RATE_BUCKETS];
+
+    long long now = iface::now();
+    long long max = (long long)_session_rate * 1000;
+
+    if (!b.stamp)
+        b.tokens = max;
+    else if (now > b.stamp)
+        b.tokens = std::min(max, b.tokens + (now - b.stamp) * _session_rate);
+
+    b.stamp = now;
+
+    if (b.tokens < 1000)
+        return false;
+
+    b.tokens -= 1000;
+    return true;
 }
 
 const ptr<iface>& proxy::ifa() const
@@ -317,6 +550,129 @@ void proxy::deadtime(int val)
     _deadtime = (val >= 0) ? val : 30000;
 }
 
+worker* proxy::owner(const address& taddr) const
+{
+    return _owners[iface::fanout_index(taddr, _owners.size())];
+}
+
+int proxy::max_sessions() const
+{
+    return _max_sessions;
+}
+
+void proxy::max_sessions(int val)
+{
+    _max_sessions = (val >= 0) ? val : 0;
+}
+
+int proxy::session_rate() const
+{
+    return _session_rate;
+}
+
+void proxy::session_rate(int val)
+{
+    _session_rate = (val >= 0) ? val : 0;
+}
+
+const counter_block<proxy::COUNTERS>& proxy::counters() const
+{
+    return _counters;
+}
+
+void proxy::count(int which, uint64_t n)
+{
+    _counters.add(which, n);
+}
+
+const std::list<ptr<proxy> >& proxy::all()
+{
+    return _list;
+}
+
+int proxy::renew_window() const
+{
+    return _renew_window;
+}
+
+void proxy::renew_window(int val)
+{
+    _renew_window = (val >= 0) ? val : 0;
+}
+
+int proxy::renew_rate() const
+{
+    return _renew_rate;
+}
+
+void proxy::renew_rate(int val)
+{
+    _renew_rate = (val >= 0) ? val : 0;
+}
+
+long long proxy::renewal_slot(const ptr<session>& se)
+{
+    if (!_renew_rate)
+        return iface::now();
+
+    shard& sh = shard_of(se->taddr());
+
+    // The shards share the limit.
+    long long interval = 1000000LL * _shards.size() / _renew_rate;
+    long long at       = iface::now() * 1000;
+
+    // Anything that's free by now needn't be remembered, which also takes
+    // care of interfaces that have gone away.
+    for (std::map<std::string, long long>::iterator rit = sh.renewals.begin();
+            rit != sh.renewals.end(); ) {
+        if (rit->second <= at)
+            sh.renewals.erase(rit++);
+        else
+            rit++;
+    }
+
+    for (small_vector<ptr<iface>, 2>::iterator it = se->_ifaces.begin();
+            it != se->_ifaces.end(); it++) {
+        std::map<std::string, long long>::iterator rit = sh.renewals.find((*it)->name());
+
+        if (rit != sh.renewals.end() && rit->second > at)
+            at = rit->second;
+    }
+
+    for (small_vector<ptr<iface>, 2>::iterator it = se->_ifaces.begin();
+            it != se->_ifaces.end(); it++) {
+        sh.renewals[(*it)->name()] = at + interval;
+    }
+
+    return (at + 999) / 1000;
+}
+
+int proxy::negative_cache_size() const
+{
+    return _negative_cache_size;
+}
+
+void proxy::negative_cache_size(int val)
+{
+    _negative_cache_size = (val >= 0) ? val : 0;
+
+    size_t size = (_negative_cache_size + _shards.size() - 1) / _shards.size();
+
+    for (size_t i = 0; i < _shards.size(); i++)
+        _shards[i].failed.reset(size, _deadtime);
+}
+
+void proxy::owners(const std::vector<worker*>& val)
+{
+    _owners = val;
+    _shards.resize(val.size());
+}
+
+proxy::shard& proxy::shard_of(const address& taddr)
+{
+    return _shards[iface::fanout_index(taddr, _shards.size())];
+}
+
 int proxy::timeout() const
 {
     return _timeout;
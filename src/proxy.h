@@ -22,21 +22,36 @@
 #include <sys/poll.h>
 
 #include "ndppd.h"
+#include "address_map.h"
+#include "prefix_trie.h"
+#include "negative_cache.h"
+#include "counter.h"
 
 NDPPD_NS_BEGIN
 
 class iface;
 class rule;
+class worker;
 
-class proxy {
+class proxy : public ptr_object {
 public:    
     static ptr<proxy> create(const ptr<iface>& ifa, bool promiscuous);
     
     static ptr<proxy> find_aunt(const std::string& ifname, const address& taddr);
 
-    static ptr<proxy> open(const std::string& ifn, bool promiscuous);
+    static ptr<proxy> open(const std::string& ifn, bool promiscuous, bool rx_ring = false,
+                           bool xdp = false);
+
+    // Drops the sessions of all proxies, unwiring their routes.
+    static void clear_sessions();
+
+    // Drops the sessions of the proxies belonging to 'owner'.
+    static void clear_sessions(worker* owner);
     
-    ptr<session> find_or_create_session(const address& taddr);
+    // Returns the session for 'taddr', setting one up if a rule matches.
+    // If 'saddr' is given, the new session is charged to that source (see
+    // session_rate()), and may be refused.
+    ptr<session> find_or_create_session(const address& taddr, const address* saddr = NULL);
     
     void handle_advert(const address& saddr, const address& taddr, const std::string& ifname, bool use_via);
     
@@ -46,6 +61,11 @@ public:
 
     void remove_session(const ptr<session>& se);
 
+    // Called when nobody answered the solicitations for the target of 'se'.
+    // If there's a negative cache, the target is added to it and the session
+    // is removed, and true is returned.
+    bool fail_session(const ptr<session>& se);
+
     ptr<rule> add_rule(const address& addr, const ptr<iface>& ifa, bool autovia);
 
     ptr<rule> add_rule(const address& addr, bool aut = false);
@@ -54,6 +74,9 @@ public:
     
     std::list<ptr<rule> >::iterator rules_end();
 
+    // Returns the most specific rules matching 'taddr', or NULL.
+    const std::vector<ptr<rule> >* find_rules(const address& taddr) const;
+
     const ptr<iface>& ifa() const;
     
     bool promiscuous() const;
@@ -86,16 +109,148 @@ public:
 
     void deadtime(int val);
 
+    int max_sessions() const;
+
+    // Limits the number of sessions to 'val', or none if 0. Once there are
+    // that many, a new session replaces the one that was solicited the least
+    // recently among those that are still waiting or invalid, or isn't set
+    // up at all if every session is valid.
+    void max_sessions(int val);
+
+    int session_rate() const;
+
+    // Limits the number of sessions the solicitations from one /64 may set
+    // up to 'val' per second, with bursts of as many, or none if 0.
+    void session_rate(int val);
+
+    int renew_window() const;
+
+    // Has valid sessions renew at a random time up to 'val' milliseconds
+    // before their ttl is up, so that those that became valid together
+    // don't stay in lockstep.
+    void renew_window(int val);
+
+    int renew_rate() const;
+
+    // Limits the renewals of this proxy to 'val' per second on each
+    // interface, or not at all if 0. Those over the limit are put off until
+    // there's room.
+    void renew_rate(int val);
+
+    // Reserves a turn for 'se' to renew on each of its interfaces, and
+    // returns the time (see iface::now()) it may do so.
+    long long renewal_slot(const ptr<session>& se);
+
+    int negative_cache_size() const;
+
+    // Sets up a negative cache for 'val' targets, or none if 0. Solicitations
+    // for targets in it are ignored, instead of being forwarded again, until
+    // they drop out after 'deadtime' to twice that. Must be called after
+    // owners() and deadtime().
+    void negative_cache_size(int val);
+
+    enum {
+        SESSIONS,
+        SESSIONS_CREATED,
+        SESSIONS_EVICTED,
+        SESSIONS_FAILED,
+        RATE_LIMITED,
+        TABLE_FULL,
+        NEGATIVE_HITS,
+        RETRIES,
+        RENEWALS,
+        RENEWALS_DEFERRED,
+        ROUTES_WIRED,
+        ROUTES_UNWIRED,
+        COUNTERS
+    };
+
+    static const counter_info counter_infos[COUNTERS];
+
+    const counter_block<COUNTERS>& counters() const;
+
+    // Bumps one of the counters, from any thread.
+    void count(int which, uint64_t n = 1);
+
+    // Returns all proxies.
+    static const std::list<ptr<proxy> >& all();
+
+    // Returns the worker handling the session for 'taddr', or NULL if
+    // there's no pool.
+    worker* owner(const address& taddr) const;
+
+    // Splits the sessions into one shard per entry of 'val', each handled
+    // by that worker. The session for 'taddr' goes to shard
+    // iface::fanout_index(taddr, val.size()), the same socket of the fanout
+    // group its solicitations arrive on.
+    void owners(const std::vector<worker*>& val);
+
 private:
     static std::list<ptr<proxy> > _list;
 
-    weak_ptr<proxy> _ptr;
-
     ptr<iface> _ifa;
 
     std::list<ptr<rule> > _rules;
 
-    std::list<ptr<session> > _sessions;
+    // The same rules, indexed by address for longest-prefix matching.
+    prefix_trie<ptr<rule> > _rule_trie;
+
+    // Number of buckets per shard for session_rate(). Sources that hash to
+    // the same bucket share it, which keeps the memory we spend on them fixed
+    // however many there are.
+    static const int RATE_BUCKETS = 256;
+
+    struct bucket {
+        long long stamp;
+
+        // Thousandths of a session.
+        long long tokens;
+    };
+
+    struct shard {
+        // Indexed by target address.
+        address_map<ptr<session> > sessions;
+
+        // The sessions that were waiting or invalid when last solicited,
+        // most recent first. Sessions that have since become valid are only
+        // dropped from the list when evict() comes across them.
+        session* idle_head;
+
+        session* idle_tail;
+
+        std::vector<bucket> buckets;
+
+        // Targets nobody answered for lately.
+        negative_cache failed;
+
+        // The next free turn for renewal_slot() on each interface, by name,
+        // in microseconds. Turns that have passed are dropped.
+        std::map<std::string, long long> renewals;
+
+        shard();
+    };
+
+    // All sessions of this proxy, in one shard per entry of _owners.
+    std::vector<shard> _shards;
+
+    std::vector<worker*> _owners;
+
+    shard& shard_of(const address& taddr);
+
+    // Takes a token from the bucket of 'saddr', if there's one left.
+    bool admit(shard& sh, const address& saddr);
+
+    // Removes the least recently solicited session that is still waiting
+    // or invalid. Returns false if there's none.
+    bool evict(shard& sh);
+
+    static void idle_link(shard& sh, session* se);
+
+    static void idle_unlink(shard& sh, session* se);
+
+    void erase_session(shard& sh, const ptr<session>& se);
+
+    void clear_shard(shard& sh);
     
     bool _promiscuous;
 
@@ -109,6 +264,12 @@ private:
 
     int _ttl, _deadtime, _timeout;
 
+    int _max_sessions, _session_rate, _negative_cache_size;
+
+    int _renew_window, _renew_rate;
+
+    counter_block<COUNTERS> _counters;
+
     proxy();
 };
 
@@ -16,6 +16,8 @@
 #pragma once
 
 #include <exception>
+#include <new>
+#include <cstddef>
 
 #include "ndppd.h"
 #include "logger.h"
@@ -27,139 +29,198 @@ public:
     invalid_pointer() throw() {};
 };
 
+
+// Base class of everything managed by ptr<>. The reference counts aren't
+// kept in a block of their own, but in a header allocated right in front
+// of the object by operator new. That header stays around for as long as
+// there are weak references, even after the object has been destroyed.
+//
+// Objects must be allocated with new, and ptr<> relies on a T* pointing
+// at the start of the allocation, so ptr<T> must only be used with T
+// being the class that was allocated. A class may get its memory from
+// somewhere else by defining an operator new of its own that calls
+// place().
+
+class ptr_object {
+public:
+    struct counts {
+        // Strong references, or -1 until the first ptr<> takes over.
+        int sc;
+
+        // Weak references, plus one for as long as the object is alive.
+        int wc;
+
+        // Frees the allocation, header included.
+        void (*free)(void* mem);
+    };
+
+    static void* operator new(size_t size)
+    {
+        return place(::operator new(HEADER_SIZE + size), free_plain);
+    }
+
+    static void operator delete(void* p)
+    {
+        if (p)
+            unref(counts_of(p));
+    }
+
+    static counts* counts_of(const void* p)
+    {
+        return (counts*)((char*)p - HEADER_SIZE);
+    }
+
+    // Drops a weak reference (or the one held on behalf of the strong
+    // ones), freeing the allocation once there are none left.
+    static void unref(counts* c)
+    {
+        if (!__sync_sub_and_fetch(&c->wc, 1))
+            c->free(c);
+    }
+
+    // Takes a strong reference, unless the object is already being
+    // destroyed.
+    static bool retain(counts* c)
+    {
+        int sc = c->sc;
+
+        while (sc) {
+            int old = __sync_val_compare_and_swap(&c->sc, sc, (sc < 0) ? 1 : sc + 1);
+
+            if (old == sc)
+                return true;
+
+            sc = old;
+        }
+
+        return false;
+    }
+
+protected:
+    // Keeps the object as aligned as plain new would.
+    static const size_t HEADER_SIZE = 16;
+
+    ptr_object()
+    {
+    }
+
+    // Sets up the header at the start of 'mem', which must hold
+    // HEADER_SIZE bytes plus the object, and returns where the object goes.
+    // 'free' is called with 'mem' once it's no longer needed.
+    static void* place(void* mem, void (*free)(void*))
+    {
+        counts* c = (counts*)mem;
+        c->sc   = -1;
+        c->wc   = 1;
+        c->free = free;
+
+        return (char*)mem + HEADER_SIZE;
+    }
+
+private:
+    static void free_plain(void* mem)
+    {
+        ::operator delete(mem);
+    }
+};
+
 template <class T>
 class weak_ptr;
 
 // This template class simplifies the usage of pointers. It's basically
 // a reference-counting smart pointer that supports both weak and
-// strong references.
+// strong references. The counts are updated atomically, so different
+// threads may hold references to the same object; a single ptr must not
+// be used by more than one thread at a time, though.
 
 template <typename T>
 class ptr {
     template <typename U>
     friend class ptr;
 
-    struct ptr_ref {
-        T* ptr;
-        int wc, sc;
-    };
+    template <typename U>
+    friend class weak_ptr;
 
 protected:
     bool _weak;
 
-    ptr_ref* _ref;
+    T* _obj;
 
-    void acquire(ptr_ref* ref)
+    void acquire(T* obj, bool strong_source = false)
     {
-        if (_ref) {
-            release();
-        }
-
-        if (ref && !ref->sc) {
-            throw new invalid_pointer;
-        }
+        if (obj) {
+            ptr_object::counts* c = ptr_object::counts_of(obj);
 
-        if (_ref = ref) {
             if (_weak) {
-                _ref->wc++;
-            } else {
-                _ref->sc++;
+                if (!c->sc) {
+                    throw new invalid_pointer;
+                }
+
+                __sync_add_and_fetch(&c->wc, 1);
+            } else if (strong_source) {
+                // The source keeps it alive, so there's nothing to check.
+                __sync_add_and_fetch(&c->sc, 1);
+            } else if (!ptr_object::retain(c)) {
+                throw new invalid_pointer;
             }
         }
+
+        release();
+
+        _obj = obj;
     }
 
-    void acquire(void* ptr)
+    void acquire(const ptr<T>& p)
     {
-        if (!ptr) return;
-
-        _ref      = new ptr_ref();
-        _ref->ptr = (T*)ptr;
-        _ref->wc  = !!_weak;
-        _ref->sc  = !_weak;
+        acquire(p._obj, !p._weak);
     }
 
     void release()
     {
-        if (!_ref) {
+        if (!_obj) {
             return;
         }
 
-        //logger::debug()
-        //    << "ptr::release() _ref=" << logger::format("%x", _ref)
-        //    << ", _ref->wc=" << _ref->wc << ", _ref->sc=" << _ref->sc
-        //    << ", _weak=" << (_weak ? "yes" : "no");
+        T* obj = _obj;
+        _obj = 0;
+
+        ptr_object::counts* c = ptr_object::counts_of(obj);
 
         if (_weak) {
-            assert(_ref->wc > 0);
-            _ref->wc--;
-        } else {
-            assert(_ref->sc > 0);
-            if (!--_ref->sc && _ref->ptr) {
-                T* ptr = _ref->ptr;
-                _ref->ptr = 0;
-                _ref->wc++;
-                delete ptr;
-                _ref->wc--;
-            }
+            assert(c->wc > 0);
+            ptr_object::unref(c);
+            return;
         }
 
-        /*if (!_weak && !_ref->sc && _ref->ptr) {
-            T* ptr = (T*)(_ref->ptr);
-            _ref->ptr = 0;
-            delete ptr;
-        }*/
+        assert(c->sc > 0);
 
-        if (!_ref->sc && !_ref->wc) {
-            delete _ref;
+        if (!__sync_sub_and_fetch(&c->sc, 1)) {
+            delete obj;
         }
-
-        _ref = 0;
-    }
-
-    template <class U>
-    void acquire(const ptr<U>& ptr)
-    {
-        acquire(ptr._ref);
     }
 
 public:
     ptr(bool weak = false) :
-        _weak(weak), _ref(0)
+        _weak(weak), _obj(0)
     {
     }
 
     ptr(T* p, bool weak = false) :
-        _weak(weak), _ref(0)
+        _weak(weak), _obj(0)
     {
         acquire(p);
     }
 
     ptr(const ptr<T>& p, bool weak = false) :
-        _weak(weak), _ref(0)
+        _weak(weak), _obj(0)
     {
-        acquire(p._ref);
+        acquire(p);
     }
 
     ptr(const weak_ptr<T>& p, bool weak = false) :
-        _weak(weak), _ref(0)
-    {
-        acquire(p._ref);
-    }
-
-    template <class U>
-    ptr(const ptr<U>& p, bool weak = false) :
-        _weak(weak), _ref(0)
-    {
-        T* x = (U*)0;
-        acquire(p._ref);
-    }
-
-    template <class U>
-    ptr(const weak_ptr<U>& p, bool weak = false) :
-        _weak(weak), _ref(0)
+        _weak(weak), _obj(0)
     {
-        T* x = (U*)0;
-        acquire(p._ref);
+        acquire(p);
     }
 
     ~ptr()
@@ -180,17 +241,17 @@ public:
 
     bool operator==(const ptr<T>& other) const
     {
-        return other._ref == _ref;
+        return other._obj == _obj;
     }
 
     bool operator!=(const ptr<T>& other) const
     {
-        return other._ref != _ref;
+        return other._obj != _obj;
     }
 
     bool is_null() const
     {
-        return !_ref || !_ref->ptr;
+        return !_obj || (_weak && !ptr_object::counts_of(_obj)->sc);
     }
 
     T& operator*() const
@@ -220,11 +281,11 @@ public:
 
     T* get_pointer() const
     {
-        if (!_ref || !_ref->ptr) {
+        if (is_null()) {
             throw new invalid_pointer;
         }
 
-        return static_cast<T* >(_ref->ptr);
+        return _obj;
     }
 };
 
@@ -251,19 +312,18 @@ public:
     {
     }
 
-    template <class U>
-    weak_ptr(const ptr<U>& p) :
-        ptr<T>(p, true)
+    // Returns a strong reference to the object, or a null one if it's
+    // gone (or going) away.
+    ptr<T> lock() const
     {
-    }
+        ptr<T> p;
 
-    template <class U>
-    weak_ptr(const weak_ptr<U>& p) :
-        ptr<T>(p, true)
-    {
+        if (this->_obj && ptr_object::retain(ptr_object::counts_of(this->_obj))) {
+            p._obj = this->_obj;
+        }
+
+        return p;
     }
 };
 
 NDPPD_NS_END
-
-
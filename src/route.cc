@@ -16,20 +16,39 @@
 #include <list>
 #include <memory>
 #include <fstream>
+#include <cstring>
+
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include "ndppd.h"
 #include "route.h"
+#include "netlink.h"
 
 NDPPD_NS_BEGIN
 
-std::list<ptr<route> > route::_routes;
+mutex route::_lock;
+
+prefix_trie<ptr<route> > route::_routes;
+
+prefix_trie<ptr<route> >* route::_staging = NULL;
 
 int route::_ttl;
 
 int route::_c_ttl;
 
+bool route::_monitored = false;
+
+bool route::_stale = false;
+
 route::route(const address& addr, const std::string& ifname) :
-    _addr(addr), _ifname(ifname)
+    _addr(addr), _ifname(ifname), _ifindex(0), _metric(0)
+{
+}
+
+route::route(const address& addr, int ifindex, int metric) :
+    _addr(addr), _ifindex(ifindex), _metric(metric)
 {
 }
 
@@ -81,11 +100,13 @@ std::string route::token(const char* str)
 
 void route::load(const std::string& path)
 {
+    mutex_lock ml(_lock);
+
     // Hack to make sure the interfaces are not freed prematurely.
-    std::list<ptr<route> > tmp_routes(_routes);
-    _routes.clear();
+    prefix_trie<ptr<route> > tmp_routes;
+    tmp_routes.swap(_routes);
 
-    logger::debug() << "reading routes";
+    DEBUG_LOG() << "reading routes";
 
     try {
         std::ifstream ifs;
@@ -127,29 +148,187 @@ void route::load(const std::string& path)
 
 void route::update(int elapsed_time)
 {
+    if (_monitored) {
+        if (_stale && (_c_ttl -= elapsed_time) <= 0)
+            reload();
+        return;
+    }
+
     if ((_c_ttl -= elapsed_time) <= 0) {
         load("/proc/net/ipv6_route");
         _c_ttl = _ttl;
     }
 }
 
+bool route::monitor()
+{
+    if (_monitored)
+        return true;
+
+    if (!netlink::open() || !netlink::subscribe(RTNLGRP_IPV6_ROUTE) || !reload()) {
+        logger::warning() << "Failed to set up netlink route monitoring, falling back to "
+                          << "reading /proc/net/ipv6_route";
+        return false;
+    }
+
+    _monitored = true;
+
+    return true;
+}
+
+bool route::reload()
+{
+    DEBUG_LOG() << "reading routes";
+
+    prefix_trie<ptr<route> > routes;
+
+    _staging = &routes;
+
+    bool ok = netlink::dump(RTM_GETROUTE);
+
+    _staging = NULL;
+
+    if (!ok) {
+        logger::warning() << "Failed to reload routes, keeping the old ones for now";
+        _stale = true;
+        _c_ttl = _ttl;
+        return false;
+    }
+
+    // The old routes are released when 'routes' goes out of scope, after
+    // the lock is.
+    {
+        mutex_lock ml(_lock);
+        routes.swap(_routes);
+    }
+
+    _stale = false;
+
+    return true;
+}
+
+void route::handle_netlink(const struct nlmsghdr* hdr)
+{
+    if (hdr->nlmsg_type != RTM_NEWROUTE && hdr->nlmsg_type != RTM_DELROUTE)
+        return;
+
+    const struct rtmsg* rtm = (const struct rtmsg*)NLMSG_DATA(hdr);
+
+    if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm)) || rtm->rtm_family != AF_INET6 ||
+            (rtm->rtm_flags & RTM_F_CLONED))
+        return;
+
+    address addr;
+    int table   = rtm->rtm_table;
+    int ifindex = 0;
+    int metric  = 0;
+
+    int len = RTM_PAYLOAD(hdr);
+
+    for (const struct rtattr* rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+        case RTA_DST:
+            if (RTA_PAYLOAD(rta) >= sizeof(struct in6_addr))
+                memcpy(&addr.addr(), RTA_DATA(rta), sizeof(struct in6_addr));
+            break;
+
+        case RTA_OIF:
+            ifindex = *(const int*)RTA_DATA(rta);
+            break;
+
+        case RTA_PRIORITY:
+            metric = *(const int*)RTA_DATA(rta);
+            break;
+
+        case RTA_TABLE:
+            table = *(const int*)RTA_DATA(rta);
+            break;
+
+        case RTA_MULTIPATH:
+            // Go with the first next hop.
+            if (!ifindex && RTA_PAYLOAD(rta) >= sizeof(struct rtnexthop))
+                ifindex = ((const struct rtnexthop*)RTA_DATA(rta))->rtnh_ifindex;
+            break;
+        }
+    }
+
+    if (table != RT_TABLE_MAIN)
+        return;
+
+    addr.prefix(rtm->rtm_dst_len);
+
+    mutex_lock ml(_lock);
+
+    if (hdr->nlmsg_type == RTM_DELROUTE) {
+        remove(addr, metric);
+        return;
+    }
+
+    if (rtm->rtm_type != RTN_UNICAST || !ifindex)
+        return;
+
+    add(new route(addr, ifindex, metric));
+}
+
+prefix_trie<ptr<route> >& route::table()
+{
+    return _staging ? *_staging : _routes;
+}
+
+void route::add(const ptr<route>& rt)
+{
+    // A route with the same prefix and metric replaces the old one.
+    remove(rt->_addr, rt->_metric);
+
+    table().insert(rt->_addr.const_addr(), rt->_addr.prefix(), rt);
+}
+
+void route::remove(const address& addr, int metric)
+{
+    int pfx = addr.prefix();
+
+    prefix_trie<ptr<route> >& routes_table = table();
+
+    const std::vector<ptr<route> >* routes = routes_table.find_exact(addr.const_addr(), pfx);
+
+    if (!routes)
+        return;
+
+    for (std::vector<ptr<route> >::const_iterator it = routes->begin(); it != routes->end(); it++) {
+        if ((*it)->_metric == metric) {
+            ptr<route> rt = *it;
+            routes_table.remove(addr.const_addr(), pfx, rt);
+            return;
+        }
+    }
+}
+
 ptr<route> route::create(const address& addr, const std::string& ifname)
 {
     ptr<route> rt(new route(addr, ifname));
     // logger::debug() << "route::create() addr=" << addr << ", ifname=" << ifname;
-    _routes.push_back(rt);
+    mutex_lock ml(_lock);
+    _routes.insert(addr.const_addr(), addr.prefix(), rt);
     return rt;
 }
 
 ptr<route> route::find(const address& addr)
 {
-    for (std::list<ptr<route> >::iterator it = _routes.begin();
-            it != _routes.end(); it++) {
-        if ((*it)->addr() == addr)
-            return *it;
+    mutex_lock ml(_lock);
+
+    const std::vector<ptr<route> >* routes = _routes.find(addr.const_addr());
+
+    if (!routes)
+        return ptr<route>();
+
+    ptr<route> best;
+
+    for (std::vector<ptr<route> >::const_iterator it = routes->begin(); it != routes->end(); it++) {
+        if (!best || (*it)->_metric < best->_metric)
+            best = *it;
     }
 
-    return ptr<route>();
+    return best;
 }
 
 ptr<iface> route::find_and_open(const address& addr)
@@ -165,17 +344,28 @@ ptr<iface> route::find_and_open(const address& addr)
 
 const std::string& route::ifname() const
 {
+    mutex_lock ml(_lock);
+
+    if (_ifname.empty() && _ifindex > 0) {
+        char buf[IF_NAMESIZE];
+
+        if (if_indextoname(_ifindex, buf))
+            _ifname = buf;
+    }
+
     return _ifname;
 }
 
 ptr<iface> route::ifa()
 {
+    mutex_lock ml(_lock);
+
     if (!_ifa) {
-        logger::debug() << "router::ifa() opening interface '" << _ifname << "'";
-        return _ifa = iface::open_ifd(_ifname);
+        DEBUG_LOG() << "router::ifa() opening interface '" << ifname() << "'";
+        _ifa = iface::open_ifd(ifname());
     }
 
-    return ptr<iface>();
+    return _ifa;
 }
 
 const address& route::addr() const
@@ -183,6 +373,19 @@ const address& route::addr() const
     return _addr;
 }
 
+int route::metric() const
+{
+    return _metric;
+}
+
+int route::next_update()
+{
+    if (_monitored && !_stale)
+        return -1;
+
+    return (_c_ttl > 0) ? _c_ttl : 0;
+}
+
 int route::ttl()
 {
     return _ttl;
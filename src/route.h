@@ -20,21 +20,42 @@
 #include <memory>
 
 #include "ndppd.h"
+#include "prefix_trie.h"
+#include "mutex.h"
+
+struct nlmsghdr;
 
 NDPPD_NS_BEGIN
 
-class route {
+class route : public ptr_object {
 public:
     static ptr<route> create(const address& addr, const std::string& ifname);
 
+    // Returns the most specific route to 'addr', preferring the lowest
+    // metric if there are several.
     static ptr<route> find(const address& addr);
 
     static ptr<iface> find_and_open(const address& addr);
 
+    // Loads the routing table over netlink and keeps it up to date from
+    // then on. Returns false if that isn't possible, in which case the
+    // table is reloaded from /proc/net/ipv6_route every ttl() ms instead.
+    static bool monitor();
+
+    // Replaces the table with a full dump of the kernel's. If that fails,
+    // the old table is kept and the dump is tried again every ttl() ms.
+    static bool reload();
+
+    static void handle_netlink(const struct nlmsghdr* hdr);
+
     static void load(const std::string& path);
 
     static void update(int elapsed_time);
 
+    // Returns the number of milliseconds until the next reload, or -1 if
+    // the table is kept up to date over netlink and nothing needs retrying.
+    static int next_update();
+
     static int ttl();
 
     static void ttl(int ttl);
@@ -43,27 +64,57 @@ public:
 
     const address& addr() const;
 
+    int metric() const;
+
     ptr<iface> ifa();
     
     route(const address& addr, const std::string& ifname);
 
+    route(const address& addr, int ifindex, int metric);
+
     static size_t hexdec(const char* str, unsigned char* buf, size_t size);
 
     static std::string token(const char* str);
 
 private:
+    // Guards _routes and the lazily resolved members of each route, since
+    // the table is looked up by the workers while the main thread reloads
+    // it.
+    static mutex _lock;
+
     static int _ttl;
 
     static int _c_ttl;
 
+    // Whether the table is kept up to date over netlink.
+    static bool _monitored;
+
+    // Set if the last reload() failed.
+    static bool _stale;
+
     address _addr;
 
-    std::string _ifname;
+    // Resolved from _ifindex the first time it's needed.
+    mutable std::string _ifname;
+
+    int _ifindex;
+
+    int _metric;
 
     ptr<iface> _ifa;
 
-    static std::list<ptr<route> > _routes;
+    static prefix_trie<ptr<route> > _routes;
+
+    // The table reload() is filling in, if it's waiting for a dump. The
+    // workers go on using _routes until it's complete.
+    static prefix_trie<ptr<route> >* _staging;
+
+    // Returns the table netlink updates go to.
+    static prefix_trie<ptr<route> >& table();
+
+    static void add(const ptr<route>& rt);
 
+    static void remove(const address& addr, int metric);
 };
 
 NDPPD_NS_END
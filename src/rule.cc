@@ -40,7 +40,6 @@ rule::rule()
 ptr<rule> rule::create(const ptr<proxy>& pr, const address& addr, const ptr<iface>& ifa)
 {
     ptr<rule> ru(new rule());
-    ru->_ptr  = ru;
     ru->_pr   = pr;
     ru->_daughter  = ifa;
     ru->_addr = addr;
@@ -57,7 +56,7 @@ ptr<rule> rule::create(const ptr<proxy>& pr, const address& addr, const ptr<ifac
     if_add_to_list(ifindex, ifa);
 #endif
 
-    logger::debug() << "rule::create() if=" << pr->ifa()->name() << ", slave=" << ifa->name() << ", addr=" << addr;
+    DEBUG_LOG() << "rule::create() if=" << pr->ifa()->name() << ", slave=" << ifa->name() << ", addr=" << addr;
 
     return ru;
 }
@@ -65,7 +64,6 @@ ptr<rule> rule::create(const ptr<proxy>& pr, const address& addr, const ptr<ifac
 ptr<rule> rule::create(const ptr<proxy>& pr, const address& addr, bool aut)
 {
     ptr<rule> ru(new rule());
-    ru->_ptr   = ru;
     ru->_pr    = pr;
     ru->_addr  = addr;
     ru->_aut   = aut;
@@ -74,7 +72,7 @@ ptr<rule> rule::create(const ptr<proxy>& pr, const address& addr, bool aut)
     if (aut == false)
         _any_static = true;
 
-    logger::debug()
+    DEBUG_LOG()
         << "rule::create() if=" << pr->ifa()->name().c_str() << ", addr=" << addr
         << ", auto=" << (aut ? "yes" : "no");
 
@@ -86,7 +84,7 @@ const address& rule::addr() const
     return _addr;
 }
 
-ptr<iface> rule::daughter() const
+const ptr<iface>& rule::daughter() const
 {
     return _daughter;
 }
@@ -29,7 +29,7 @@ NDPPD_NS_BEGIN
 class iface;
 class proxy;
 
-class rule {
+class rule : public ptr_object {
 public:
     static ptr<rule> create(const ptr<proxy>& pr, const address& addr, const ptr<iface>& ifa);
 
@@ -37,7 +37,7 @@ public:
 
     const address& addr() const;
 
-    ptr<iface> daughter() const;
+    const ptr<iface>& daughter() const;
 
     bool is_auto() const;
 
@@ -54,8 +54,6 @@ public:
     void autovia(bool val);
 
 private:
-    weak_ptr<rule> _ptr;
-
     weak_ptr<proxy> _pr;
 
     ptr<iface> _daughter;
@@ -14,60 +14,91 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <algorithm>
-#include <sstream>
+#include <stdlib.h>
+#include <sys/random.h>
 
 #include "ndppd.h"
 #include "proxy.h"
 #include "iface.h"
 #include "session.h"
+#include "netlink.h"
+#include "object_pool.h"
 
 NDPPD_NS_BEGIN
 
-std::list<weak_ptr<session> > session::_sessions;
+__thread std::vector<session*>* session::_timers = NULL;
 
 static address all_nodes = address("ff02::1");
 
-void session::update_all(int elapsed_time)
+// Returns a random number in [0, 'range').
+static int jitter(int range)
 {
-    for (std::list<weak_ptr<session> >::iterator it = _sessions.begin();
-            it != _sessions.end(); ) {
-        if (!*it) {
-            _sessions.erase(it++);
-            continue;
-        }
+    static __thread unsigned int seed = 0;
 
-        ptr<session> se = *it++;
+    if (!seed && getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed))
+        seed = (unsigned int)iface::now();
 
-        if ((se->_ttl -= elapsed_time) >= 0) {
-            continue;
-        }
+    return (range > 0) ? rand_r(&seed) % range : 0;
+}
+
+session::session() :
+    _autowire(false), _keepalive(false), _wired(false), _touched(false), _offloaded(false),
+    _deadline(0), _fails(0), _retries(0), _status(WAITING), _timer_index(-1),
+    _idle_prev(NULL), _idle_next(NULL), _idle(false), _paced(false)
+{
+}
+
+std::vector<session*>& session::timers()
+{
+    // Never freed: sessions are still being torn down (and unscheduled)
+    // while static objects are destroyed at exit.
+    if (!_timers)
+        _timers = new std::vector<session*>();
+
+    return *_timers;
+}
+
+void session::update_all()
+{
+    long long now = iface::now();
+
+    while (!timers().empty() && timers()[0]->_deadline <= now) {
+        ptr<session> se = timers()[0];
+
+        se->unschedule();
 
         switch (se->_status) {
             
         case session::WAITING:
             if (se->_fails < se->_retries) {
-                logger::debug() << "session will keep trying [taddr=" << se->_taddr << "]";
+                DEBUG_LOG() << "session will keep trying [taddr=" << se->_taddr << "]";
                 
-                se->_ttl     = se->_pr->timeout();
+                se->schedule(se->_pr->timeout());
                 se->_fails++;
+                se->_pr->count(proxy::RETRIES);
                 
                 // Send another solicit
                 se->send_solicit();
+            } else if (se->_pr->fail_session(se)) {
+                DEBUG_LOG() << "session failed, target is now negatively cached [taddr=" << se->_taddr << "]";
+                se->_pr->count(proxy::SESSIONS_FAILED);
             } else {
                 
-                logger::debug() << "session is now invalid [taddr=" << se->_taddr << "]";
+                DEBUG_LOG() << "session is now invalid [taddr=" << se->_taddr << "]";
+                se->_pr->count(proxy::SESSIONS_FAILED);
                 
                 se->_status = session::INVALID;
-                se->_ttl    = se->_pr->deadtime();
+                se->schedule(se->_pr->deadtime());
             }
             break;
             
         case session::RENEWING:
-            logger::debug() << "session is became invalid [taddr=" << se->_taddr << "]";
+            DEBUG_LOG() << "session is became invalid [taddr=" << se->_taddr << "]";
             
             if (se->_fails < se->_retries) {
-                se->_ttl     = se->_pr->timeout();
+                se->schedule(se->_pr->timeout());
                 se->_fails++;
+                se->_pr->count(proxy::RETRIES);
                 
                 // Send another solicit
                 se->send_solicit();
@@ -76,13 +107,35 @@ void session::update_all(int elapsed_time)
             }
             break;
             
-        case session::VALID:            
+        case session::VALID:
+            // Solicitations answered by the XDP program never made it here
+            // to touch the session.
+            if (se->_offloaded && se->_pr->ifa()->offload_hit(se->_taddr))
+                se->_touched = true;
+
             if (se->touched() == true ||
                 se->keepalive() == true)
             {
-                logger::debug() << "session is renewing [taddr=" << se->_taddr << "]";
+                // Wait our turn if too many others are renewing on the
+                // same interfaces.
+                if (se->_paced == false) {
+                    long long at = se->_pr->renewal_slot(se);
+
+                    if (at > now) {
+                        DEBUG_LOG() << "session will renew in " << (int)(at - now) << " ms [taddr=" << se->_taddr << "]";
+                        se->_paced = true;
+                        se->_pr->count(proxy::RENEWALS_DEFERRED);
+                        se->schedule((int)(at - now));
+                        break;
+                    }
+                }
+
+                se->_paced = false;
+
+                DEBUG_LOG() << "session is renewing [taddr=" << se->_taddr << "]";
+                se->_pr->count(proxy::RENEWALS);
                 se->_status  = session::RENEWING;
-                se->_ttl     = se->_pr->timeout();
+                se->schedule(se->_pr->timeout());
                 se->_fails   = 0;
                 se->_touched = false;
 
@@ -99,35 +152,140 @@ void session::update_all(int elapsed_time)
     }
 }
 
+int session::next_timeout()
+{
+    if (timers().empty())
+        return -1;
+
+    long long now = iface::now();
+
+    return (timers()[0]->_deadline > now) ? (int)(timers()[0]->_deadline - now) : 0;
+}
+
+void session::timer_set(size_t i, session* se)
+{
+    timers()[i] = se;
+    se->_timer_index = i;
+}
+
+void session::timer_up(size_t i)
+{
+    session* se = timers()[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (timers()[parent]->_deadline <= se->_deadline)
+            break;
+
+        timer_set(i, timers()[parent]);
+        i = parent;
+    }
+
+    timer_set(i, se);
+}
+
+void session::timer_down(size_t i)
+{
+    session* se = timers()[i];
+    size_t size = timers().size();
+
+    for (;;) {
+        size_t child = i * 2 + 1;
+
+        if (child >= size)
+            break;
+
+        if (child + 1 < size && timers()[child + 1]->_deadline < timers()[child]->_deadline)
+            child++;
+
+        if (se->_deadline <= timers()[child]->_deadline)
+            break;
+
+        timer_set(i, timers()[child]);
+        i = child;
+    }
+
+    timer_set(i, se);
+}
+
+void session::schedule(int ttl)
+{
+    _deadline = iface::now() + ttl;
+
+    if (_timer_index < 0) {
+        timers().push_back(this);
+        _timer_index = timers().size() - 1;
+    }
+
+    // The new deadline may be earlier or later than the old one.
+    timer_up(_timer_index);
+    timer_down(_timer_index);
+}
+
+void session::unschedule()
+{
+    if (_timer_index < 0)
+        return;
+
+    size_t i = _timer_index;
+    session* last = timers().back();
+
+    timers().pop_back();
+    _timer_index = -1;
+
+    if (last != this) {
+        timer_set(i, last);
+        timer_up(i);
+        timer_down(last->_timer_index);
+    }
+}
+
 session::~session()
 {
-    logger::debug() << "session::~session() this=" << logger::format("%x", this);
+    DEBUG_LOG() << "session::~session() this=" << logger::format("%x", this);
+
+    unschedule();
+
+    if (_offloaded == true) {
+        ptr<proxy> pr = _pr.lock();
+
+        if (pr && pr->ifa())
+            pr->ifa()->withdraw_advert(_taddr);
+    }
     
     if (_wired == true) {
-        for (std::list<ptr<iface> >::iterator it = _ifaces.begin();
+        for (small_vector<ptr<iface>, 2>::iterator it = _ifaces.begin();
             it != _ifaces.end(); it++) {
             handle_auto_unwire((*it)->name());
         }
     }
 }
 
+void* session::operator new(size_t size)
+{
+    typedef object_pool<HEADER_SIZE + sizeof(session)> pool;
+
+    assert(size == sizeof(session));
+
+    return place(pool::alloc(), pool::free);
+}
+
 ptr<session> session::create(const ptr<proxy>& pr, const address& taddr, bool auto_wire, bool keepalive, int retries)
 {
     ptr<session> se(new session());
 
-    se->_ptr       = se;
     se->_pr        = pr;
     se->_taddr     = taddr;
     se->_autowire  = auto_wire;
     se->_keepalive = keepalive;
     se->_retries   = retries;
     se->_wired     = false;
-    se->_ttl       = pr->ttl();
     se->_touched   = false;
 
-    _sessions.push_back(se);
+    se->schedule(pr->ttl());
 
-    logger::debug()
+    DEBUG_LOG()
         << "session::create() pr=" << logger::format("%x", (proxy* )pr) << ", proxy=" << ((pr->ifa()) ? pr->ifa()->name() : "null")
         << ", taddr=" << taddr << " =" << logger::format("%x", (session* )se);
 
@@ -144,22 +302,22 @@ void session::add_iface(const ptr<iface>& ifa)
 
 void session::add_pending(const address& addr)
 {
-    for (std::list<ptr<address> >::iterator ad = _pending.begin(); ad != _pending.end(); ad++) {
+    for (small_vector<address, 4>::const_iterator ad = _pending.begin(); ad != _pending.end(); ad++) {
         if (addr == (*ad))
             return;
     }
 
-    _pending.push_back(new address(addr));
+    _pending.push_back(addr);
 }
 
 void session::send_solicit()
 {
-    logger::debug() << "session::send_solicit() (_ifaces.size() = " << _ifaces.size() << ")";
+    DEBUG_LOG() << "session::send_solicit() (_ifaces.size() = " << _ifaces.size() << ")";
 
-    for (std::list<ptr<iface> >::iterator it = _ifaces.begin();
+    for (small_vector<ptr<iface>, 2>::iterator it = _ifaces.begin();
             it != _ifaces.end(); it++) {
-        logger::debug() << " - " << (*it)->name();
-        (*it)->write_solicit(_taddr);
+        DEBUG_LOG() << " - " << (*it)->name();
+        (*it)->queue_solicit(_taddr);
     }
 }
 
@@ -170,9 +328,9 @@ void session::touch()
         _touched = true;
         
         if (status() == session::WAITING || status() == session::INVALID) {
-            _ttl = _pr->timeout();
+            schedule(_pr->timeout());
             
-            logger::debug() << "session is now probing [taddr=" << _taddr << "]";
+            DEBUG_LOG() << "session is now probing [taddr=" << _taddr << "]";
             
             send_solicit();
         }
@@ -189,7 +347,7 @@ void session::handle_auto_wire(const address& saddr, const std::string& ifname,
     if (_wired == true && (_wired_via.is_empty() || _wired_via == saddr))
         return;
     
-    logger::debug()
+    DEBUG_LOG()
         << "session::handle_auto_wire() taddr=" << _taddr << ", ifname=" << ifname;
     
     if (use_via == true &&
@@ -197,91 +355,39 @@ void session::handle_auto_wire(const address& saddr, const std::string& ifname,
         saddr.is_unicast() == true &&
         saddr.is_multicast() == false)
     {
-        std::stringstream route_cmd;
-        route_cmd << "ip";
-        route_cmd << " " << "-6";
-        route_cmd << " " << "route";
-        route_cmd << " " << "replace";
-        route_cmd << " " << std::string(saddr);
-        route_cmd << " " << "dev";
-        route_cmd << " " << ifname;
-
-        logger::debug()
-            << "session::system(" << route_cmd.str() << ")";
-        
-        system(route_cmd.str().c_str());
+        netlink::replace_route(saddr, address(), ifname);
         
         _wired_via = saddr;
     }
     else
         _wired_via.reset();
     
-    {
-        std::stringstream route_cmd;
-        route_cmd << "ip";
-        route_cmd << " " << "-6";
-        route_cmd << " " << "route";
-        route_cmd << " " << "replace";
-        route_cmd << " " << std::string(_taddr);
-        if (_wired_via.is_empty() == false) {
-            route_cmd << " " << "via";
-            route_cmd << " " << std::string(_wired_via);
-        }
-        route_cmd << " " << "dev";
-        route_cmd << " " << ifname;
-
-        logger::debug()
-            << "session::system(" << route_cmd.str() << ")";
-
-        system(route_cmd.str().c_str());
-    }
+    netlink::replace_route(_taddr, _wired_via, ifname);
     
     _wired = true;
+
+    _pr->count(proxy::ROUTES_WIRED);
 }
 
 void session::handle_auto_unwire(const std::string& ifname)
 {
-    logger::debug()
+    DEBUG_LOG()
         << "session::handle_auto_unwire() taddr=" << _taddr << ", ifname=" << ifname;
     
-    {
-        std::stringstream route_cmd;
-        route_cmd << "ip";
-        route_cmd << " " << "-6";
-        route_cmd << " " << "route";
-        route_cmd << " " << "flush";
-        route_cmd << " " << std::string(_taddr);
-        if (_wired_via.is_empty() == false) {
-            route_cmd << " " << "via";
-            route_cmd << " " << std::string(_wired_via);
-        }
-        route_cmd << " " << "dev";
-        route_cmd << " " << ifname;
-
-        logger::debug()
-            << "session::system(" << route_cmd.str() << ")";
-
-        system(route_cmd.str().c_str());
-    }
+    netlink::delete_route(_taddr, _wired_via, ifname);
     
     if (_wired_via.is_empty() == false) {
-        std::stringstream route_cmd;
-        route_cmd << "ip";
-        route_cmd << " " << "-6";
-        route_cmd << " " << "route";
-        route_cmd << " " << "flush";
-        route_cmd << " " << std::string(_wired_via);
-        route_cmd << " " << "dev";
-        route_cmd << " " << ifname;
-
-        logger::debug()
-            << "session::system(" << route_cmd.str() << ")";
-
-        system(route_cmd.str().c_str());
+        netlink::delete_route(_wired_via, address(), ifname);
     }
     
     _wired = false;
     _wired_via.reset();
+
+    // We may be going away along with the proxy.
+    ptr<proxy> pr = _pr.lock();
+
+    if (pr)
+        pr->count(proxy::ROUTES_UNWIRED);
 }
 
 void session::handle_advert(const address& saddr, const std::string& ifname, bool use_via)
@@ -296,27 +402,32 @@ void session::handle_advert(const address& saddr, const std::string& ifname, boo
 
 void session::handle_advert()
 {
-    logger::debug()
+    DEBUG_LOG()
         << "session::handle_advert() taddr=" << _taddr << ", ttl=" << _pr->ttl();
     
     if (_status != VALID) {
         _status = VALID;
         
-        logger::debug() << "session is active [taddr=" << _taddr << "]";
+        DEBUG_LOG() << "session is active [taddr=" << _taddr << "]";
     }
+
+    if (_offloaded == false)
+        _offloaded = _pr->ifa()->offload_advert(_taddr, _pr->router());
     
-    _ttl    = _pr->ttl();
+    // Sessions that became valid together (after a restart, say) would
+    // otherwise keep renewing in lockstep.
+    schedule(_pr->ttl() - jitter(std::min(_pr->renew_window(), _pr->ttl())));
+    _paced  = false;
     _fails  = 0;
     
     if (!_pending.empty()) {
-        for (std::list<ptr<address> >::iterator ad = _pending.begin();
+        for (small_vector<address, 4>::const_iterator ad = _pending.begin();
                 ad != _pending.end(); ad++) {
-            ptr<address> addr = (*ad);
-            logger::debug() << " - forward to " << addr;
-
-            send_advert(addr);
+            DEBUG_LOG() << " - forward to " << *ad;
         }
 
+        _pr->ifa()->write_adverts(_pending.begin(), _pending.size(), _taddr, _pr->router());
+
         _pending.clear();
     }
 }
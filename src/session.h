@@ -19,16 +19,15 @@
 #include <string>
 
 #include "ndppd.h"
+#include "small_vector.h"
 
 NDPPD_NS_BEGIN
 
 class proxy;
 class iface;
 
-class session {
+class session : public ptr_object {
 private:
-    weak_ptr<session> _ptr;
-
     weak_ptr<proxy> _pr;
 
     address _saddr, _daddr, _taddr;
@@ -43,15 +42,21 @@ private:
     
     bool _touched;
 
+    // Whether the proxy's XDP program answers solicitations for _taddr.
+    bool _offloaded;
+
     // An array of interfaces this session is monitoring for
-    // ND_NEIGHBOR_ADVERT on.
-    std::list<ptr<iface> > _ifaces;
+    // ND_NEIGHBOR_ADVERT on. Usually just the one.
+    small_vector<ptr<iface>, 2> _ifaces;
     
-    std::list<ptr<address> > _pending;
+    // Those waiting for an answer, see add_pending(). Rarely more than a
+    // few, so they're kept inline.
+    small_vector<address, 4> _pending;
 
-    // The remaining time in miliseconds the object will stay in the
-    // interface's session array or cache.
-    int _ttl;
+    // The time (see iface::now()) at which the current state of the object
+    // expires, and it either retries, renews or leaves the interface's
+    // session array or cache.
+    long long _deadline;
     
     int _fails;
     
@@ -59,7 +64,42 @@ private:
 
     int _status;
 
-    static std::list<weak_ptr<session> > _sessions;
+    // Position of this session in _timers, or -1 if it isn't scheduled.
+    int _timer_index;
+
+    // Links in the proxy's list of idle sessions, see proxy::evict().
+    session* _idle_prev;
+
+    session* _idle_next;
+
+    bool _idle;
+
+    // Whether the session has been put off by proxy::renewal_slot() and
+    // may renew once it expires.
+    bool _paced;
+
+    // Binary min-heap of the sessions scheduled by the calling thread,
+    // ordered by _deadline, so that update_all() only has to look at the
+    // ones that have expired. Sessions stay with the worker that owns their
+    // proxy, so they're always scheduled and unscheduled by the same thread.
+    static __thread std::vector<session*>* _timers;
+
+    static std::vector<session*>& timers();
+
+    static void timer_set(size_t i, session* se);
+
+    static void timer_up(size_t i);
+
+    static void timer_down(size_t i);
+
+    // Sets up the session to expire 'ttl' milliseconds from now.
+    void schedule(int ttl);
+
+    void unschedule();
+
+    session();
+
+    friend class proxy;
 
 public:
     enum
@@ -70,7 +110,16 @@ public:
         INVALID   // Invalid;
     };
 
-    static void update_all(int elapsed_time);
+    // Handles the expired sessions of the calling thread.
+    static void update_all();
+
+    // Returns the number of milliseconds until the next session of the
+    // calling thread expires, or -1 if there are none.
+    static int next_timeout();
+
+    // Sessions come and go at a high rate while someone's scanning a
+    // prefix, so they're allocated from a pool.
+    static void* operator new(size_t size);
 
     // Destructor.
     ~session();
@@ -0,0 +1,164 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <new>
+#include <cstddef>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// A vector that keeps up to N elements inside the object itself, and only
+// goes to the heap once it outgrows that. Meant for short lists that are
+// created and thrown away all the time, like the solicitors waiting on a
+// session.
+
+template <typename T, size_t N>
+class small_vector {
+public:
+    typedef T* iterator;
+
+    typedef const T* const_iterator;
+
+    small_vector() :
+        _data((T*)_inline.buf), _size(0), _capacity(N)
+    {
+    }
+
+    small_vector(const small_vector<T, N>& other) :
+        _data((T*)_inline.buf), _size(0), _capacity(N)
+    {
+        for (const_iterator it = other.begin(); it != other.end(); it++)
+            push_back(*it);
+    }
+
+    ~small_vector()
+    {
+        clear();
+
+        if (_data != (T*)_inline.buf)
+            ::operator delete(_data);
+    }
+
+    small_vector<T, N>& operator=(const small_vector<T, N>& other)
+    {
+        if (this != &other) {
+            clear();
+
+            for (const_iterator it = other.begin(); it != other.end(); it++)
+                push_back(*it);
+        }
+
+        return *this;
+    }
+
+    void push_back(const T& value)
+    {
+        if (_size == _capacity) {
+            // 'value' may live in the storage we're about to give up.
+            T tmp(value);
+            grow(_capacity * 2);
+            ::new (&_data[_size]) T(tmp);
+        } else {
+            ::new (&_data[_size]) T(value);
+        }
+
+        _size++;
+    }
+
+    // Destroys the elements, but keeps whatever storage has been
+    // allocated.
+    void clear()
+    {
+        for (size_t i = 0; i < _size; i++)
+            _data[i].~T();
+
+        _size = 0;
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return !_size;
+    }
+
+    T& operator[](size_t i)
+    {
+        return _data[i];
+    }
+
+    const T& operator[](size_t i) const
+    {
+        return _data[i];
+    }
+
+    iterator begin()
+    {
+        return _data;
+    }
+
+    iterator end()
+    {
+        return _data + _size;
+    }
+
+    const_iterator begin() const
+    {
+        return _data;
+    }
+
+    const_iterator end() const
+    {
+        return _data + _size;
+    }
+
+private:
+    T* _data;
+
+    size_t _size, _capacity;
+
+    union {
+        char buf[N * sizeof(T)];
+
+        // Only here to align 'buf'.
+        long double align;
+
+        void* ptr;
+    } _inline;
+
+    void grow(size_t capacity)
+    {
+        T* data = (T*)::operator new(capacity * sizeof(T));
+
+        for (size_t i = 0; i < _size; i++) {
+            ::new (&data[i]) T(_data[i]);
+            _data[i].~T();
+        }
+
+        if (_data != (T*)_inline.buf)
+            ::operator delete(_data);
+
+        _data     = data;
+        _capacity = capacity;
+    }
+};
+
+NDPPD_NS_END
@@ -0,0 +1,319 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ndppd.h"
+#include "stats.h"
+#include "proxy.h"
+
+NDPPD_NS_BEGIN
+
+int stats::_fd = -1;
+
+std::string stats::_path;
+
+std::map<int, stats::client> stats::_clients;
+
+bool stats::open(const std::string& path)
+{
+    struct sockaddr_un addr;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        logger::error() << "Stats socket path '" << path << "' is too long";
+        return false;
+    }
+
+    if ((_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+        logger::error() << "Unable to create stats socket: " << logger::err();
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    unlink(path.c_str());
+
+    if (bind(_fd, (struct sockaddr* )&addr, sizeof(addr)) < 0 || listen(_fd, 8) < 0) {
+        logger::error() << "Unable to listen on '" << path << "': " << logger::err();
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+
+    _path = path;
+
+    if (!iface::watch(_fd, accept)) {
+        close();
+        return false;
+    }
+
+    DEBUG_LOG() << "stats::open() path=" << path;
+
+    return true;
+}
+
+void stats::close()
+{
+    if (_fd < 0)
+        return;
+
+    while (!_clients.empty())
+        drop(_clients.begin()->first);
+
+    iface::unwatch(_fd);
+    ::close(_fd);
+    unlink(_path.c_str());
+
+    _fd = -1;
+}
+
+void stats::accept(int fd)
+{
+    int cfd;
+
+    while ((cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+        if (_clients.size() >= MAX_CLIENTS)
+            drop(_clients.begin()->first);
+
+        if (!iface::watch(cfd, read)) {
+            ::close(cfd);
+            continue;
+        }
+
+        _clients[cfd].sent = 0;
+    }
+}
+
+void stats::drop(int fd)
+{
+    iface::unwatch(fd);
+    ::close(fd);
+    _clients.erase(fd);
+}
+
+void stats::read(int fd)
+{
+    std::map<int, client>::iterator it = _clients.find(fd);
+
+    if (it == _clients.end())
+        return;
+
+    char buf[64];
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            drop(fd);
+        return;
+    }
+
+    std::string& request = it->second.request;
+
+    request.append(buf, len);
+
+    size_t eol = request.find('\n');
+
+    // Wait for the rest of the line, unless that's all we're getting.
+    if (len > 0 && eol == std::string::npos && request.size() < sizeof(buf))
+        return;
+
+    request.erase(std::min(eol, request.size()));
+
+    if (!request.empty() && request[request.size() - 1] == '\r')
+        request.erase(request.size() - 1);
+
+    it->second.reply = reply(request);
+
+    // From here on, we're only waiting for the client to take the reply.
+    iface::unwatch(fd);
+
+    if (!iface::watch(fd, flush, true)) {
+        drop(fd);
+        return;
+    }
+
+    flush(fd);
+}
+
+void stats::flush(int fd)
+{
+    std::map<int, client>::iterator it = _clients.find(fd);
+
+    if (it == _clients.end())
+        return;
+
+    client& c = it->second;
+
+    while (c.sent < c.reply.size()) {
+        ssize_t len = send(fd, c.reply.data() + c.sent, c.reply.size() - c.sent, MSG_NOSIGNAL);
+
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            break;
+        }
+
+        c.sent += len;
+    }
+
+    drop(fd);
+}
+
+std::string stats::reply(const std::string& request)
+{
+    std::ostringstream os;
+
+    if (request.empty() || request == "text") {
+        write(os, TEXT);
+    } else if (request == "json") {
+        write(os, JSON);
+    } else if (request == "prometheus") {
+        write(os, PROMETHEUS);
+    } else {
+        os << "unknown format '" << request << "', try text, json or prometheus\n";
+    }
+
+    return os.str();
+}
+
+void stats::write(std::ostream& os, int format)
+{
+    group groups[2];
+
+    groups[0].kind  = "iface";
+    groups[0].infos = iface::counter_infos;
+    groups[0].size  = iface::COUNTERS;
+
+    mutex_lock ml(iface::_lock);
+
+    for (std::map<std::string, weak_ptr<iface> >::iterator it = iface::_map.begin();
+            it != iface::_map.end(); it++) {
+        ptr<iface> ifa = it->second.lock();
+
+        if (!ifa)
+            continue;
+
+        groups[0].names.push_back(ifa->name());
+        groups[0].values.push_back(std::vector<uint64_t>(iface::COUNTERS));
+
+        for (int i = 0; i < iface::COUNTERS; i++)
+            groups[0].values.back()[i] = ifa->counters().get(i);
+    }
+
+    groups[1].kind  = "proxy";
+    groups[1].infos = proxy::counter_infos;
+    groups[1].size  = proxy::COUNTERS;
+
+    for (std::list<ptr<proxy> >::const_iterator it = proxy::all().begin();
+            it != proxy::all().end(); it++) {
+        const ptr<proxy>& pr = *it;
+
+        groups[1].names.push_back(pr->ifa()->name());
+        groups[1].values.push_back(std::vector<uint64_t>(proxy::COUNTERS));
+
+        for (int i = 0; i < proxy::COUNTERS; i++)
+            groups[1].values.back()[i] = pr->counters().get(i);
+    }
+
+    if (format == JSON)
+        os << "{";
+
+    for (int g = 0; g < 2; g++) {
+        switch (format) {
+        case JSON:
+            os << (g ? ", " : "");
+            write_json(os, groups[g]);
+            break;
+
+        case PROMETHEUS:
+            write_prometheus(os, groups[g]);
+            break;
+
+        default:
+            write_text(os, groups[g]);
+        }
+    }
+
+    if (format == JSON)
+        os << "}\n";
+}
+
+void stats::write_text(std::ostream& os, const group& g)
+{
+    for (size_t n = 0; n < g.names.size(); n++) {
+        os << g.kind << " " << g.names[n] << "\n";
+
+        for (size_t i = 0; i < g.size; i++)
+            os << "  " << g.infos[i].name << " " << g.values[n][i] << "\n";
+    }
+}
+
+// Interface names may contain just about anything.
+static std::string quote(const std::string& str)
+{
+    std::string out("\"");
+
+    for (size_t i = 0; i < str.size(); i++) {
+        if (str[i] == '"' || str[i] == '\\')
+            out += '\\';
+
+        out += str[i];
+    }
+
+    return out + "\"";
+}
+
+void stats::write_json(std::ostream& os, const group& g)
+{
+    os << quote(g.kind) << ": {";
+
+    for (size_t n = 0; n < g.names.size(); n++) {
+        os << (n ? ", " : "") << quote(g.names[n]) << ": {";
+
+        for (size_t i = 0; i < g.size; i++)
+            os << (i ? ", " : "") << quote(g.infos[i].name) << ": " << g.values[n][i];
+
+        os << "}";
+    }
+
+    os << "}";
+}
+
+void stats::write_prometheus(std::ostream& os, const group& g)
+{
+    for (size_t i = 0; i < g.size; i++) {
+        std::string metric = std::string("ndppd_") + g.kind + "_" + g.infos[i].name;
+
+        if (!g.infos[i].gauge)
+            metric += "_total";
+
+        os << "# HELP " << metric << " " << g.infos[i].help << "\n"
+           << "# TYPE " << metric << " " << (g.infos[i].gauge ? "gauge" : "counter") << "\n";
+
+        for (size_t n = 0; n < g.names.size(); n++)
+            os << metric << "{" << g.kind << "=" << quote(g.names[n]) << "} " << g.values[n][i] << "\n";
+    }
+}
+
+NDPPD_NS_END
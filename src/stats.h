@@ -0,0 +1,100 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <stdint.h>
+
+#include "ndppd.h"
+#include "counter.h"
+
+NDPPD_NS_BEGIN
+
+// Serves the counters of all interfaces and proxies on a UNIX stream
+// socket, from the main event loop. A client connects, sends a line naming
+// the format it wants ("text", "json" or "prometheus"; an empty line, or
+// none at all, means "text") and reads the reply until the socket is
+// closed.
+
+class stats {
+public:
+    enum { TEXT, JSON, PROMETHEUS };
+
+    // Starts listening on 'path', replacing whatever is there.
+    static bool open(const std::string& path);
+
+    static void close();
+
+    // Writes all counters to 'os' in 'format'.
+    static void write(std::ostream& os, int format);
+
+private:
+    // The counters of one kind of object, as of when write() was called.
+    struct group {
+        const char* kind;
+
+        const counter_info* infos;
+
+        size_t size;
+
+        std::vector<std::string> names;
+
+        std::vector<std::vector<uint64_t> > values;
+    };
+
+    struct client {
+        // What the client has sent so far.
+        std::string request;
+
+        // The reply, and how much of it has been sent.
+        std::string reply;
+
+        size_t sent;
+    };
+
+    // Clients we're still waiting to hear from, or to take the rest of
+    // their reply, are dropped beyond this.
+    static const size_t MAX_CLIENTS = 16;
+
+    static int _fd;
+
+    static std::string _path;
+
+    static std::map<int, client> _clients;
+
+    static void accept(int fd);
+
+    static void read(int fd);
+
+    // Sends what the client can take of the rest of its reply, and drops
+    // it once it's all gone.
+    static void flush(int fd);
+
+    static std::string reply(const std::string& request);
+
+    static void drop(int fd);
+
+    static void write_text(std::ostream& os, const group& g);
+
+    static void write_json(std::ostream& os, const group& g);
+
+    static void write_prometheus(std::ostream& os, const group& g);
+};
+
+NDPPD_NS_END
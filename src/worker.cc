@@ -0,0 +1,238 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "ndppd.h"
+#include "worker.h"
+#include "netlink.h"
+
+NDPPD_NS_BEGIN
+
+std::vector<worker*> worker::_workers;
+
+size_t worker::_next = 0;
+
+std::map<std::string, worker*> worker::_owners;
+
+__thread worker* worker::_current = NULL;
+
+worker::worker() :
+    _epfd(-1), _efd(-1), _started(false), _running(false), _signalled(0)
+{
+}
+
+bool worker::create(int count)
+{
+    for (int i = 0; i < count; i++) {
+        worker* w = new worker();
+
+        if (!i) {
+            // The main thread's loop.
+            w->_epfd = iface::loop_fd();
+        } else {
+            w->_epfd = epoll_create1(EPOLL_CLOEXEC);
+        }
+
+        if (w->_epfd < 0) {
+            logger::error() << "Failed to create epoll instance: " << logger::err();
+            return false;
+        }
+
+        if ((w->_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+            logger::error() << "Failed to create eventfd: " << logger::err();
+            return false;
+        }
+
+        _workers.push_back(w);
+    }
+
+    _current = _workers[0];
+
+    return iface::watch(_current->_efd, wakeup);
+}
+
+worker* worker::assign()
+{
+    if (_workers.empty())
+        return NULL;
+
+    return _workers[_next++ % _workers.size()];
+}
+
+worker* worker::current()
+{
+    return _current;
+}
+
+worker* worker::owner(const ptr<iface>& ifa)
+{
+    std::map<std::string, worker*>::iterator it = _owners.find(ifa->name());
+
+    return (it != _owners.end()) ? it->second : NULL;
+}
+
+bool worker::adopt(const ptr<iface>& ifa, int member)
+{
+    if (member)
+        return ifa->move_fanout(member, _epfd);
+
+    if (!ifa->move_to(_epfd))
+        return false;
+
+    _owners[ifa->name()] = this;
+
+    return true;
+}
+
+bool worker::start_all()
+{
+    for (size_t i = 1; i < _workers.size(); i++) {
+        worker* w = _workers[i];
+
+        w->_running = true;
+
+        int err = pthread_create(&w->_thread, NULL, run, w);
+
+        if (err) {
+            w->_running = false;
+            logger::error() << "Failed to start worker " << (int)i << ": " << strerror(err);
+            return false;
+        }
+
+        w->_started = true;
+    }
+
+    return true;
+}
+
+void worker::stop_all()
+{
+    for (size_t i = 1; i < _workers.size(); i++) {
+        worker* w = _workers[i];
+
+        if (!w->_started)
+            continue;
+
+        uint64_t one = 1;
+
+        w->_running = false;
+
+        if (::write(w->_efd, &one, sizeof(one)) < 0)
+            logger::warning() << "Failed to wake up worker " << (int)i << ": " << logger::err();
+
+        pthread_join(w->_thread, NULL);
+
+        w->_started = false;
+    }
+}
+
+void* worker::run(void* arg)
+{
+    worker* w = (worker*)arg;
+
+    _current = w;
+
+    iface::loop_fd(w->_epfd);
+
+    if (iface::watch(w->_efd, wakeup)) {
+        while (w->_running) {
+            if (iface::poll_all(session::next_timeout()) < 0)
+                break;
+
+            session::update_all();
+
+            // Send the solicitations queued while handling this batch.
+            iface::flush_solicits();
+
+            // Send off any route changes made while handling this batch.
+            netlink::flush();
+        }
+
+        iface::unwatch(w->_efd);
+    }
+
+    // Unwire while we still can.
+    proxy::clear_sessions(w);
+    netlink::flush();
+
+    return NULL;
+}
+
+void worker::post(int type, const ptr<proxy>& pr, const address& saddr, const address& taddr,
+                  const std::string& ifname, bool use_via)
+{
+    task t;
+
+    t.type    = type;
+    t.pr      = pr;
+    t.saddr   = saddr;
+    t.taddr   = taddr;
+    t.ifname  = ifname;
+    t.use_via = use_via;
+
+    _tasks.push(t);
+
+    // Only the first task since the last wakeup needs to write to _efd.
+    if (__sync_bool_compare_and_swap(&_signalled, 0, 1)) {
+        uint64_t one = 1;
+
+        if (::write(_efd, &one, sizeof(one)) < 0)
+            logger::warning() << "Failed to wake up worker: " << logger::err();
+    }
+}
+
+void worker::wakeup(int fd)
+{
+    worker* w = _current;
+
+    uint64_t count;
+
+    if (::read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        logger::warning() << "Failed to read from eventfd: " << logger::err();
+
+    // Anything posted from here on writes to _efd again, so nothing that
+    // the loop below misses gets stuck in the queue.
+    __sync_lock_release(&w->_signalled);
+    __sync_synchronize();
+
+    task t;
+
+    while (w->_tasks.pop(t)) {
+        switch (t.type) {
+        case ADVERT:
+            t.pr->handle_advert(t.saddr, t.taddr, t.ifname, t.use_via);
+            break;
+
+        case STATELESS_ADVERT:
+            t.pr->handle_stateless_advert(t.saddr, t.taddr, t.ifname, t.use_via);
+            break;
+
+        case SOLICIT:
+            t.pr->handle_solicit(t.saddr, t.taddr, t.ifname);
+            break;
+        }
+    }
+
+    // Don't hold on to the proxy any longer than needed.
+    t.pr = ptr<proxy>();
+}
+
+NDPPD_NS_END
@@ -0,0 +1,128 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <pthread.h>
+
+#include "ndppd.h"
+#include "mpsc_queue.h"
+
+NDPPD_NS_BEGIN
+
+class iface;
+class proxy;
+
+// A thread running an event loop of its own. Each proxy belongs to one
+// worker, and the sockets of its interface are polled by that worker's
+// loop only, so that its sessions are only ever touched by one thread.
+//
+// Adverts picked up on an interface polled by another worker are handed
+// over through a lock-free queue, and the owner is woken up through an
+// eventfd registered with its loop.
+//
+// The first worker is the main thread itself, which keeps running the loop
+// in main(); the others get threads of their own.
+
+class worker {
+public:
+    // Sets up a pool of 'count' workers.
+    static bool create(int count);
+
+    // Returns the next worker to hand a proxy to, going round the pool, or
+    // NULL if there's no pool.
+    static worker* assign();
+
+    // Returns the worker the calling thread belongs to, or NULL if there's
+    // no pool.
+    static worker* current();
+
+    // Returns the worker polling the interface 'ifa', or NULL.
+    static worker* owner(const ptr<iface>& ifa);
+
+    // Starts the threads of all workers but the first one.
+    static bool start_all();
+
+    // Stops all threads started by start_all(), and waits for them to
+    // drop their sessions.
+    static void stop_all();
+
+    // Has this worker poll the sockets of 'ifa' from now on, or just socket
+    // 'member' of its fanout group if that's nonzero.
+    bool adopt(const ptr<iface>& ifa, int member = 0);
+
+    // Things that can be handed to another worker.
+    enum {
+        ADVERT,           // proxy::handle_advert()
+        STATELESS_ADVERT, // proxy::handle_stateless_advert()
+        SOLICIT           // proxy::handle_solicit()
+    };
+
+    // Has this worker call the handler of 'pr' given by 'type' with the
+    // given arguments.
+    void post(int type, const ptr<proxy>& pr, const address& saddr, const address& taddr,
+              const std::string& ifname, bool use_via = false);
+
+private:
+    struct task {
+        int type;
+
+        ptr<proxy> pr;
+
+        address saddr, taddr;
+
+        std::string ifname;
+
+        bool use_via;
+    };
+
+    static std::vector<worker*> _workers;
+
+    static size_t _next;
+
+    static std::map<std::string, worker*> _owners;
+
+    static __thread worker* _current;
+
+    // The epoll instance of this worker's loop.
+    int _epfd;
+
+    // The eventfd used to wake up the loop when there are tasks.
+    int _efd;
+
+    pthread_t _thread;
+
+    bool _started;
+
+    volatile bool _running;
+
+    // Whether _efd has been written to since the last wakeup.
+    int _signalled;
+
+    mpsc_queue<task> _tasks;
+
+    static void* run(void* arg);
+
+    // Handles a readable _efd.
+    static void wakeup(int fd);
+
+    worker();
+};
+
+NDPPD_NS_END
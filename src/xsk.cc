@@ -0,0 +1,771 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include <cstring>
+#include <cerrno>
+#include <cstddef>
+
+#include <unistd.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include "ndppd.h"
+#include "xsk.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+NDPPD_NS_BEGIN
+
+int xsk::_local_fd = -1;
+
+int xsk::_answer_fd = -1;
+
+static int sys_bpf(int cmd, union bpf_attr* attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    struct bpf_insn i;
+
+    i.code    = code;
+    i.dst_reg = dst;
+    i.src_reg = src;
+    i.off     = off;
+    i.imm     = imm;
+
+    return i;
+}
+
+static int create_map(int type, int key_size, int value_size, int max_entries)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type    = type;
+    attr.key_size    = key_size;
+    attr.value_size  = value_size;
+    attr.max_entries = max_entries;
+
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int update_map(int fd, const void* key, const void* value)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key    = (uintptr_t)key;
+    attr.value  = (uintptr_t)value;
+    attr.flags  = BPF_ANY;
+
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static bool is_veth(const std::string& ifname)
+{
+    struct ethtool_drvinfo info;
+    struct ifreq ifr;
+
+    int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+
+    if (fd < 0)
+        return false;
+
+    memset(&info, 0, sizeof(info));
+    info.cmd = ETHTOOL_GDRVINFO;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+    ifr.ifr_data = (char* )&info;
+
+    int ret = ioctl(fd, SIOCETHTOOL, &ifr);
+
+    close(fd);
+
+    return ret >= 0 && !strcmp(info.driver, "veth");
+}
+
+xsk::xsk() :
+    _ifindex(0), _fd(-1), _map_fd(-1), _prog_fd(-1), _link_fd(-1), _umem(NULL), _tx_pending(0)
+{
+    memset(&_rx, 0, sizeof(_rx));
+    memset(&_tx, 0, sizeof(_tx));
+    memset(&_fill, 0, sizeof(_fill));
+    memset(&_comp, 0, sizeof(_comp));
+}
+
+xsk::~xsk()
+{
+    DEBUG_LOG() << "xsk::~xsk() ifname=" << _ifname;
+
+    // Detach the program first, so nothing is redirected to a dead socket.
+    if (_link_fd >= 0)
+        close(_link_fd);
+
+    if (_prog_fd >= 0)
+        close(_prog_fd);
+
+    if (_map_fd >= 0)
+        close(_map_fd);
+
+    ring* rings[] = { &_rx, &_tx, &_fill, &_comp };
+
+    for (int i = 0; i < 4; i++) {
+        if (rings[i]->map)
+            munmap(rings[i]->map, rings[i]->map_size);
+    }
+
+    if (_fd >= 0)
+        close(_fd);
+
+    if (_umem)
+        munmap(_umem, (size_t)FRAMES * FRAME_SIZE);
+}
+
+ptr<xsk> xsk::open(const std::string& ifname)
+{
+    int ifindex = if_nametoindex(ifname.c_str());
+
+    if (!ifindex) {
+        logger::error() << "Failed to find interface '" << ifname << "'";
+        return ptr<xsk>();
+    }
+
+    ptr<xsk> xs(new xsk());
+
+    xs->_ifname  = ifname;
+    xs->_ifindex = ifindex;
+
+    if (!xs->setup(ifindex))
+        return ptr<xsk>();
+
+    DEBUG_LOG() << "xsk::open() ifname=" << ifname << ", fd=" << xs->_fd;
+
+    return xs;
+}
+
+bool xsk::setup(int ifindex)
+{
+    if ((_fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0) {
+        logger::error() << "Unable to create AF_XDP socket: " << logger::err();
+        return false;
+    }
+
+    // Register the UMEM.
+
+    size_t size = (size_t)FRAMES * FRAME_SIZE;
+
+    void* umem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (umem == MAP_FAILED) {
+        logger::error() << "Unable to allocate UMEM: " << logger::err();
+        return false;
+    }
+
+    _umem = (uint8_t* )umem;
+
+    struct xdp_umem_reg reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.addr       = (uintptr_t)_umem;
+    reg.len        = size;
+    reg.chunk_size = FRAME_SIZE;
+
+    if (setsockopt(_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+        logger::error() << "Unable to register UMEM: " << logger::err();
+        return false;
+    }
+
+    // Set up and map the rings.
+
+    int n = RING_SIZE;
+
+    if (setsockopt(_fd, SOL_XDP, XDP_UMEM_FILL_RING, &n, sizeof(n)) < 0 ||
+            setsockopt(_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &n, sizeof(n)) < 0 ||
+            setsockopt(_fd, SOL_XDP, XDP_RX_RING, &n, sizeof(n)) < 0 ||
+            setsockopt(_fd, SOL_XDP, XDP_TX_RING, &n, sizeof(n)) < 0) {
+        logger::error() << "Unable to set up AF_XDP rings: " << logger::err();
+        return false;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+
+    if (getsockopt(_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        logger::error() << "Unable to get AF_XDP ring offsets: " << logger::err();
+        return false;
+    }
+
+    if (!map_ring(_rx, _fd, XDP_PGOFF_RX_RING, off.rx, sizeof(struct xdp_desc)) ||
+            !map_ring(_tx, _fd, XDP_PGOFF_TX_RING, off.tx, sizeof(struct xdp_desc)) ||
+            !map_ring(_fill, _fd, XDP_UMEM_PGOFF_FILL_RING, off.fr, sizeof(uint64_t)) ||
+            !map_ring(_comp, _fd, XDP_UMEM_PGOFF_COMPLETION_RING, off.cr, sizeof(uint64_t))) {
+        logger::error() << "Unable to map AF_XDP rings: " << logger::err();
+        return false;
+    }
+
+    // Hand the first half of the frames to the kernel to receive into, and
+    // keep the rest for transmitting.
+
+    uint64_t* fill = (uint64_t* )_fill.descs;
+
+    for (int i = 0; i < RING_SIZE; i++)
+        fill[i] = (uint64_t)i * FRAME_SIZE;
+
+    __atomic_store_n(_fill.producer, RING_SIZE, __ATOMIC_RELEASE);
+
+    for (int i = RING_SIZE; i < FRAMES; i++)
+        _tx_free.push_back((uint64_t)i * FRAME_SIZE);
+
+    struct sockaddr_xdp sxdp;
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family   = AF_XDP;
+    sxdp.sxdp_ifindex  = ifindex;
+    sxdp.sxdp_queue_id = 0;
+
+    if (bind(_fd, (struct sockaddr* )&sxdp, sizeof(sxdp)) < 0) {
+        logger::error() << "Unable to bind AF_XDP socket to '" << _ifname << "': " << logger::err();
+        return false;
+    }
+
+    return load_program(ifindex);
+}
+
+bool xsk::map_ring(ring& r, int fd, off_t pgoff, const struct xdp_ring_offset& off, size_t desc_size)
+{
+    r.map_size = off.desc + RING_SIZE * desc_size;
+
+    void* map = mmap(NULL, r.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+
+    if (map == MAP_FAILED) {
+        r.map = NULL;
+        return false;
+    }
+
+    r.map      = map;
+    r.producer = (uint32_t* )((uint8_t* )map + off.producer);
+    r.consumer = (uint32_t* )((uint8_t* )map + off.consumer);
+    r.flags    = (uint32_t* )((uint8_t* )map + off.flags);
+    r.descs    = (uint8_t* )map + off.desc;
+    r.mask     = RING_SIZE - 1;
+
+    return true;
+}
+
+bool xsk::load_program(int ifindex)
+{
+    if (_local_fd < 0 &&
+            (_local_fd = create_map(BPF_MAP_TYPE_HASH, sizeof(struct in6_addr), 1, 4096)) < 0) {
+        logger::error() << "Unable to create BPF map: " << logger::err();
+        return false;
+    }
+
+    if (_answer_fd < 0 &&
+            (_answer_fd = create_map(BPF_MAP_TYPE_HASH, sizeof(struct answer_key),
+                                     sizeof(struct answer), 4096)) < 0) {
+        logger::error() << "Unable to create BPF map: " << logger::err();
+        return false;
+    }
+
+    if ((_map_fd = create_map(BPF_MAP_TYPE_XSKMAP, 4, 4, 1)) < 0) {
+        logger::error() << "Unable to create XSKMAP: " << logger::err();
+        return false;
+    }
+
+    int key = 0;
+
+    if (update_map(_map_fd, &key, &_fd) < 0) {
+        logger::error() << "Unable to add AF_XDP socket to XSKMAP: " << logger::err();
+        return false;
+    }
+
+    // Offsets into the frame, which must be long enough to hold an NS.
+    const int off_type   = offsetof(struct ether_header, ether_type);
+    const int off_plen   = ETH_HLEN + offsetof(struct ip6_hdr, ip6_plen);
+    const int off_nxt    = ETH_HLEN + offsetof(struct ip6_hdr, ip6_nxt);
+    const int off_hlim   = ETH_HLEN + offsetof(struct ip6_hdr, ip6_hlim);
+    const int off_src    = ETH_HLEN + offsetof(struct ip6_hdr, ip6_src);
+    const int off_dst    = ETH_HLEN + offsetof(struct ip6_hdr, ip6_dst);
+    const int off_icmp   = ETH_HLEN + sizeof(struct ip6_hdr) + offsetof(struct icmp6_hdr, icmp6_type);
+    const int off_cksum  = ETH_HLEN + sizeof(struct ip6_hdr) + offsetof(struct icmp6_hdr, icmp6_cksum);
+    const int off_flags  = ETH_HLEN + sizeof(struct ip6_hdr) + offsetof(struct nd_neighbor_advert, nd_na_flags_reserved);
+    const int off_target = ETH_HLEN + sizeof(struct ip6_hdr) + offsetof(struct nd_neighbor_solicit, nd_ns_target);
+    const int off_end    = off_target + sizeof(struct in6_addr);
+
+    // An NS with exactly one link-layer address option has the same layout
+    // as the NA we answer it with, so that one can be rewritten in place.
+    const int msg_size   = sizeof(struct nd_neighbor_solicit) + 8;
+    const int off_opt    = off_end;
+    const int off_hw     = off_opt + sizeof(struct nd_opt_hdr);
+    const int off_msgend = off_opt + 8;
+
+    // Upper-layer length and next header of the pseudo-header, summed the
+    // same way bpf_csum_diff() sums the rest.
+    const int csum_seed  = htons(msg_size) + htons(IPPROTO_ICMPV6);
+
+    // Jump offsets are relative to the next instruction.
+    const int redirect = 124, pass = 130;
+
+    struct bpf_insn prog[] = {
+        // r6 = ctx, r2 = data, r3 = data_end.
+        /*  0 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+        /*  1 */ insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, data), 0),
+        /*  2 */ insn(BPF_LDX | BPF_MEM | BPF_W, 3, 6, offsetof(struct xdp_md, data_end), 0),
+        // Bail if the frame is too short.
+        /*  3 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+        /*  4 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, off_end),
+        /*  5 */ insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, pass - 6, 0),
+        // Bail if it's *not* ETHERTYPE_IPV6.
+        /*  6 */ insn(BPF_LDX | BPF_MEM | BPF_H, 4, 2, off_type, 0),
+        /*  7 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, pass - 8, htons(ETHERTYPE_IPV6)),
+        // Bail if the next header is *not* IPPROTO_ICMPV6.
+        /*  8 */ insn(BPF_LDX | BPF_MEM | BPF_B, 4, 2, off_nxt, 0),
+        /*  9 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, pass - 10, IPPROTO_ICMPV6),
+        // Bail if it's *not* ND_NEIGHBOR_SOLICIT.
+        /* 10 */ insn(BPF_LDX | BPF_MEM | BPF_B, 4, 2, off_icmp, 0),
+        /* 11 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, pass - 12, ND_NEIGHBOR_SOLICIT),
+        // Bail if the target is one of our own addresses. r7 = data,
+        // r8 = data_end from here on, since calls clobber r1 to r5.
+        /* 12 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 7, 2, 0, 0),
+        /* 13 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 8, 3, 0, 0),
+        /* 14 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, off_target),
+        /* 15 */ insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, _local_fd),
+        /* 16 */ insn(0, 0, 0, 0, 0),
+        /* 17 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        /* 18 */ insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, pass - 19, 0),
+        // Look for an answer, keyed on target and interface (see
+        // struct answer_key), and hand the NS to userspace if there's none.
+        /* 19 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 7, off_target, 0),
+        /* 20 */ insn(BPF_STX | BPF_MEM | BPF_DW, 10, 1, -24, 0),
+        /* 21 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 7, off_target + 8, 0),
+        /* 22 */ insn(BPF_STX | BPF_MEM | BPF_DW, 10, 1, -16, 0),
+        /* 23 */ insn(BPF_LDX | BPF_MEM | BPF_W, 1, 6, offsetof(struct xdp_md, ingress_ifindex), 0),
+        /* 24 */ insn(BPF_STX | BPF_MEM | BPF_W, 10, 1, -8, 0),
+        /* 25 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+        /* 26 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -24),
+        /* 27 */ insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, _answer_fd),
+        /* 28 */ insn(0, 0, 0, 0, 0),
+        /* 29 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        /* 30 */ insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, redirect - 31, 0),
+        // r9 = the struct answer. Leave anything but a plain NS with a
+        // single option to userspace.
+        /* 31 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 9, 0, 0, 0),
+        /* 32 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 7, 0, 0),
+        /* 33 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, off_msgend),
+        /* 34 */ insn(BPF_JMP | BPF_JGT | BPF_X, 4, 8, redirect - 35, 0),
+        /* 35 */ insn(BPF_LDX | BPF_MEM | BPF_B, 4, 7, off_hlim, 0),
+        /* 36 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, redirect - 37, 255),
+        /* 37 */ insn(BPF_LDX | BPF_MEM | BPF_H, 4, 7, off_plen, 0),
+        /* 38 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, redirect - 39, htons(msg_size)),
+        // That option has to be the source link-layer address, and the
+        // code 0. DAD solicitations come from :: and may carry a nonce
+        // option instead; those are left to userspace too.
+        /* 39 */ insn(BPF_LDX | BPF_MEM | BPF_B, 4, 7, off_icmp + 1, 0),
+        /* 40 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, redirect - 41, 0),
+        /* 41 */ insn(BPF_LDX | BPF_MEM | BPF_H, 4, 7, off_opt, 0),
+        /* 42 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, redirect - 43, htons((ND_OPT_SOURCE_LINKADDR << 8) | 1)),
+        /* 43 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 4, 7, off_src, 0),
+        /* 44 */ insn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, 2, 0),
+        /* 45 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 4, 7, off_src + 8, 0),
+        /* 46 */ insn(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, redirect - 47, 0),
+        // Check the checksum, like nd_packet::parse_frame() does, as the
+        // frame hasn't been looked at by anyone yet.
+        /* 47 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 0),
+        /* 48 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 2, 0, 0, 0),
+        /* 49 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 3, 7, 0, 0),
+        /* 50 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, off_src),
+        /* 51 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 2 * sizeof(struct in6_addr)),
+        /* 52 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 5, 0, 0, csum_seed),
+        /* 53 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_csum_diff),
+        /* 54 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 0),
+        /* 55 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 2, 0, 0, 0),
+        /* 56 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 3, 7, 0, 0),
+        /* 57 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, off_icmp),
+        /* 58 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, msg_size),
+        /* 59 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 5, 0, 0, 0),
+        /* 60 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_csum_diff),
+        /* 61 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 1, 0, 0, 0),
+        /* 62 */ insn(BPF_ALU64 | BPF_RSH | BPF_K, 1, 0, 0, 16),
+        /* 63 */ insn(BPF_ALU64 | BPF_AND | BPF_K, 0, 0, 0, 0xffff),
+        /* 64 */ insn(BPF_ALU64 | BPF_ADD | BPF_X, 0, 1, 0, 0),
+        /* 65 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 1, 0, 0, 0),
+        /* 66 */ insn(BPF_ALU64 | BPF_RSH | BPF_K, 1, 0, 0, 16),
+        /* 67 */ insn(BPF_ALU64 | BPF_AND | BPF_K, 0, 0, 0, 0xffff),
+        /* 68 */ insn(BPF_ALU64 | BPF_ADD | BPF_X, 0, 1, 0, 0),
+        /* 69 */ insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, redirect - 70, 0xffff),
+        // Count the hit.
+        /* 70 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 1),
+        /* 71 */ insn(BPF_STX | BPF_XADD | BPF_W, 9, 1, offsetof(struct answer, hits), 0),
+        // Ethernet: back to the sender, from us.
+        /* 72 */ insn(BPF_LDX | BPF_MEM | BPF_W, 1, 7, ETH_ALEN, 0),
+        /* 73 */ insn(BPF_STX | BPF_MEM | BPF_W, 7, 1, 0, 0),
+        /* 74 */ insn(BPF_LDX | BPF_MEM | BPF_H, 1, 7, ETH_ALEN + 4, 0),
+        /* 75 */ insn(BPF_STX | BPF_MEM | BPF_H, 7, 1, 4, 0),
+        /* 76 */ insn(BPF_LDX | BPF_MEM | BPF_W, 1, 9, offsetof(struct answer, hwaddr), 0),
+        /* 77 */ insn(BPF_STX | BPF_MEM | BPF_W, 7, 1, ETH_ALEN, 0),
+        /* 78 */ insn(BPF_LDX | BPF_MEM | BPF_H, 1, 9, offsetof(struct answer, hwaddr) + 4, 0),
+        /* 79 */ insn(BPF_STX | BPF_MEM | BPF_H, 7, 1, ETH_ALEN + 4, 0),
+        // IPv6: back to the sender, from the target.
+        /* 80 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 7, off_src, 0),
+        /* 81 */ insn(BPF_STX | BPF_MEM | BPF_DW, 7, 1, off_dst, 0),
+        /* 82 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 7, off_src + 8, 0),
+        /* 83 */ insn(BPF_STX | BPF_MEM | BPF_DW, 7, 1, off_dst + 8, 0),
+        /* 84 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 7, off_target, 0),
+        /* 85 */ insn(BPF_STX | BPF_MEM | BPF_DW, 7, 1, off_src, 0),
+        /* 86 */ insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 7, off_target + 8, 0),
+        /* 87 */ insn(BPF_STX | BPF_MEM | BPF_DW, 7, 1, off_src + 8, 0),
+        // ICMPv6: type, code and checksum, then the flags.
+        /* 88 */ insn(BPF_ST | BPF_MEM | BPF_W, 7, 0, off_icmp, ntohl(ND_NEIGHBOR_ADVERT << 24)),
+        /* 89 */ insn(BPF_ST | BPF_MEM | BPF_W, 7, 0, off_flags, 0),
+        /* 90 */ insn(BPF_LDX | BPF_MEM | BPF_B, 1, 9, offsetof(struct answer, flags), 0),
+        /* 91 */ insn(BPF_STX | BPF_MEM | BPF_B, 7, 1, off_flags, 0),
+        // Turn the source link-layer address option into a target one.
+        /* 92 */ insn(BPF_ST | BPF_MEM | BPF_B, 7, 0, off_opt, ND_OPT_TARGET_LINKADDR),
+        /* 93 */ insn(BPF_ST | BPF_MEM | BPF_B, 7, 0, off_opt + 1, 1),
+        /* 94 */ insn(BPF_LDX | BPF_MEM | BPF_W, 1, 9, offsetof(struct answer, hwaddr), 0),
+        /* 95 */ insn(BPF_STX | BPF_MEM | BPF_W, 7, 1, off_hw, 0),
+        /* 96 */ insn(BPF_LDX | BPF_MEM | BPF_H, 1, 9, offsetof(struct answer, hwaddr) + 4, 0),
+        /* 97 */ insn(BPF_STX | BPF_MEM | BPF_H, 7, 1, off_hw + 4, 0),
+        // Checksum the addresses, then the message.
+        /* 98 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 0),
+        /* 99 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 2, 0, 0, 0),
+        /*100 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 3, 7, 0, 0),
+        /*101 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, off_src),
+        /*102 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 2 * sizeof(struct in6_addr)),
+        /*103 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 5, 0, 0, csum_seed),
+        /*104 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_csum_diff),
+        /*105 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 0),
+        /*106 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 2, 0, 0, 0),
+        /*107 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 3, 7, 0, 0),
+        /*108 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, off_icmp),
+        /*109 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, msg_size),
+        /*110 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 5, 0, 0, 0),
+        /*111 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_csum_diff),
+        // Fold it to 16 bits, twice to take care of the carry.
+        /*112 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 1, 0, 0, 0),
+        /*113 */ insn(BPF_ALU64 | BPF_RSH | BPF_K, 1, 0, 0, 16),
+        /*114 */ insn(BPF_ALU64 | BPF_AND | BPF_K, 0, 0, 0, 0xffff),
+        /*115 */ insn(BPF_ALU64 | BPF_ADD | BPF_X, 0, 1, 0, 0),
+        /*116 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, 1, 0, 0, 0),
+        /*117 */ insn(BPF_ALU64 | BPF_RSH | BPF_K, 1, 0, 0, 16),
+        /*118 */ insn(BPF_ALU64 | BPF_AND | BPF_K, 0, 0, 0, 0xffff),
+        /*119 */ insn(BPF_ALU64 | BPF_ADD | BPF_X, 0, 1, 0, 0),
+        /*120 */ insn(BPF_ALU64 | BPF_XOR | BPF_K, 0, 0, 0, 0xffff),
+        /*121 */ insn(BPF_STX | BPF_MEM | BPF_H, 7, 0, off_cksum, 0),
+        /*122 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_TX),
+        /*123 */ insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        // redirect: to the socket for this queue, if there is one.
+        /*124 */ insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index), 0),
+        /*125 */ insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, _map_fd),
+        /*126 */ insn(0, 0, 0, 0, 0),
+        /*127 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+        /*128 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        /*129 */ insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        // pass:
+        /*130 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+        /*131 */ insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+    };
+
+    static char license[] = "GPL";
+    static char log[65536];
+
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type            = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insns                = (uintptr_t)prog;
+    attr.insn_cnt             = sizeof(prog) / sizeof(prog[0]);
+    attr.license              = (uintptr_t)license;
+
+    if ((_prog_fd = sys_bpf(BPF_PROG_LOAD, &attr)) < 0) {
+        logger::error() << "Unable to load XDP program: " << logger::err();
+
+        // Try again, just to find out what the verifier didn't like.
+        attr.log_buf   = (uintptr_t)log;
+        attr.log_size  = sizeof(log);
+        attr.log_level = 1;
+
+        if (sys_bpf(BPF_PROG_LOAD, &attr) < 0) {
+            // It explains itself at the end of the log, so that's the part
+            // worth keeping, a line at a time.
+            const int tail = 20;
+            int lines      = 0;
+
+            log[sizeof(log) - 1] = '\0';
+
+            for (const char* p = log; *p; p++) {
+                if (*p == '\n')
+                    lines++;
+            }
+
+            const char* p = log;
+
+            for (int skip = lines - tail; skip > 0; skip--)
+                p = strchr(p, '\n') + 1;
+
+            while (*p) {
+                const char* eol = strchr(p, '\n');
+                size_t len      = eol ? (size_t)(eol - p) : strlen(p);
+
+                if (len)
+                    logger::error() << "  " << std::string(p, len);
+
+                p += len + (eol ? 1 : 0);
+            }
+        }
+
+        return false;
+    }
+
+    // Let the kernel pick native mode if the driver supports it, and fall
+    // back to generic (skb) mode otherwise. In native mode, veth drops
+    // whatever the program bounces back (XDP_TX) unless the peer happens to
+    // run XDP itself, so go straight for generic mode there.
+    uint32_t modes[] = { 0, XDP_FLAGS_SKB_MODE };
+
+    for (int i = is_veth(_ifname) ? 1 : 0; i < 2 && _link_fd < 0; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd        = _prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type    = BPF_XDP;
+        attr.link_create.flags          = modes[i];
+
+        _link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    }
+
+    if (_link_fd < 0) {
+        logger::error() << "Unable to attach XDP program to '" << _ifname << "': " << logger::err();
+        return false;
+    }
+
+    return true;
+}
+
+int xsk::fd() const
+{
+    return _fd;
+}
+
+int xsk::receive(const uint8_t** frames, size_t* lens, int max)
+{
+    uint32_t cons = *_rx.consumer;
+    uint32_t prod = __atomic_load_n(_rx.producer, __ATOMIC_ACQUIRE);
+
+    int n = prod - cons;
+
+    if (n > max)
+        n = max;
+
+    const struct xdp_desc* descs = (const struct xdp_desc* )_rx.descs;
+
+    for (int i = 0; i < n; i++) {
+        const struct xdp_desc& desc = descs[(cons + i) & _rx.mask];
+        frames[i] = _umem + desc.addr;
+        lens[i]   = desc.len;
+    }
+
+    return n;
+}
+
+void xsk::release(int count)
+{
+    if (count <= 0)
+        return;
+
+    uint32_t cons = *_rx.consumer;
+    uint32_t prod = *_fill.producer;
+
+    const struct xdp_desc* descs = (const struct xdp_desc* )_rx.descs;
+    uint64_t* fill = (uint64_t* )_fill.descs;
+
+    // The fill ring is as large as the number of frames we receive into,
+    // so there's always room for the ones we give back.
+    for (int i = 0; i < count; i++) {
+        fill[(prod + i) & _fill.mask] =
+            descs[(cons + i) & _rx.mask].addr & ~(uint64_t)(FRAME_SIZE - 1);
+    }
+
+    __atomic_store_n(_fill.producer, prod + count, __ATOMIC_RELEASE);
+    __atomic_store_n(_rx.consumer, cons + count, __ATOMIC_RELEASE);
+}
+
+void xsk::reclaim()
+{
+    uint32_t cons = *_comp.consumer;
+    uint32_t prod = __atomic_load_n(_comp.producer, __ATOMIC_ACQUIRE);
+
+    const uint64_t* comp = (const uint64_t* )_comp.descs;
+
+    for (; cons != prod; cons++)
+        _tx_free.push_back(comp[cons & _comp.mask]);
+
+    __atomic_store_n(_comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+bool xsk::transmit(const uint8_t* frame, size_t len)
+{
+    if (len > FRAME_SIZE)
+        return false;
+
+    if (_tx_free.empty())
+        reclaim();
+
+    uint32_t prod = *_tx.producer + _tx_pending;
+
+    if (_tx_free.empty() || prod - __atomic_load_n(_tx.consumer, __ATOMIC_ACQUIRE) >= RING_SIZE)
+        return false;
+
+    uint64_t addr = _tx_free.back();
+    _tx_free.pop_back();
+
+    memcpy(_umem + addr, frame, len);
+
+    struct xdp_desc& desc = ((struct xdp_desc* )_tx.descs)[prod & _tx.mask];
+
+    desc.addr    = addr;
+    desc.len     = len;
+    desc.options = 0;
+
+    _tx_pending++;
+
+    return true;
+}
+
+void xsk::flush()
+{
+    if (!_tx_pending)
+        return;
+
+    __atomic_store_n(_tx.producer, *_tx.producer + _tx_pending, __ATOMIC_RELEASE);
+    _tx_pending = 0;
+
+    if (sendto(_fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+            errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+        logger::warning() << "xsk::flush() failed: " << logger::err();
+    }
+}
+
+bool xsk::add_answer(const address& taddr, const struct ether_addr& hwaddr, uint8_t flags)
+{
+    struct answer_key key;
+    struct answer value;
+
+    memset(&key, 0, sizeof(key));
+    key.target  = taddr.const_addr();
+    key.ifindex = _ifindex;
+
+    memset(&value, 0, sizeof(value));
+    memcpy(value.hwaddr, &hwaddr, sizeof(value.hwaddr));
+    value.flags = flags;
+
+    if (update_map(_answer_fd, &key, &value) < 0) {
+        logger::warning() << "Unable to add " << taddr << " to the XDP answer map: " << logger::err();
+        return false;
+    }
+
+    return true;
+}
+
+void xsk::remove_answer(const address& taddr)
+{
+    struct answer_key key;
+
+    memset(&key, 0, sizeof(key));
+    key.target  = taddr.const_addr();
+    key.ifindex = _ifindex;
+
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = _answer_fd;
+    attr.key    = (uintptr_t)&key;
+
+    sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+uint32_t xsk::answer_hits(const address& taddr)
+{
+    struct answer_key key;
+    struct answer value;
+
+    memset(&key, 0, sizeof(key));
+    key.target  = taddr.const_addr();
+    key.ifindex = _ifindex;
+
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = _answer_fd;
+    attr.key    = (uintptr_t)&key;
+    attr.value  = (uintptr_t)&value;
+
+    if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) < 0 || !value.hits)
+        return 0;
+
+    // Hits counted in between are lost, which doesn't matter much.
+    uint32_t hits = value.hits;
+    value.hits    = 0;
+
+    update_map(_answer_fd, &key, &value);
+
+    return hits;
+}
+
+void xsk::add_local(const address& addr)
+{
+    if (_local_fd < 0)
+        return;
+
+    uint8_t one = 1;
+
+    update_map(_local_fd, &addr.const_addr(), &one);
+}
+
+void xsk::remove_local(const address& addr)
+{
+    if (_local_fd < 0)
+        return;
+
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = _local_fd;
+    attr.key    = (uintptr_t)&addr.const_addr();
+
+    sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+NDPPD_NS_END
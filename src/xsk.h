@@ -0,0 +1,159 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/if_xdp.h>
+
+#include "ndppd.h"
+
+NDPPD_NS_BEGIN
+
+// An AF_XDP socket bound to the first queue of an interface, along with the
+// XDP program that steers Neighbor Solicitations into it. Frames land in a
+// memory area (the UMEM) shared with the kernel and are handled in place;
+// replies go out through the socket's TX ring.
+//
+// Solicitations for our own addresses are left to the kernel, since
+// nobody else is going to answer them. Those addresses are kept in a BPF
+// map shared by all interfaces; see add_local() and remove_local().
+//
+// Solicitations for targets with a valid session are answered by the
+// program itself, by turning them into adverts and bouncing them back out
+// (XDP_TX); see add_answer(). Only the rest ever reach userspace.
+
+class xsk : public ptr_object {
+public:
+    static ptr<xsk> open(const std::string& ifname);
+
+    ~xsk();
+
+    int fd() const;
+
+    // Fills 'frames' and 'lens' with up to 'max' received frames, and
+    // returns how many there were. They stay valid until release().
+    int receive(const uint8_t** frames, size_t* lens, int max);
+
+    // Gives the 'count' frames returned by receive() back to the kernel.
+    void release(int count);
+
+    // Queues 'frame' for transmission. Returns false if there's no room,
+    // in which case the caller should send it some other way.
+    bool transmit(const uint8_t* frame, size_t len);
+
+    // Sends whatever transmit() has queued.
+    void flush();
+
+    // Lets the XDP program answer solicitations for 'taddr' on this
+    // interface by itself, with an advert carrying 'hwaddr' as the target
+    // link-layer address and 'flags' as the first byte of its flags.
+    bool add_answer(const address& taddr, const struct ether_addr& hwaddr, uint8_t flags);
+
+    void remove_answer(const address& taddr);
+
+    // Returns the number of solicitations for 'taddr' the XDP program has
+    // answered since the last call.
+    uint32_t answer_hits(const address& taddr);
+
+    static void add_local(const address& addr);
+
+    static void remove_local(const address& addr);
+
+private:
+    // One of the four rings shared with the kernel.
+    struct ring {
+        uint32_t* producer;
+
+        uint32_t* consumer;
+
+        uint32_t* flags;
+
+        void* descs;
+
+        uint32_t mask;
+
+        void* map;
+
+        size_t map_size;
+    };
+
+    // Number and size of the frames in the UMEM. The first half is used for
+    // receiving, the second half for transmitting.
+    static const int FRAMES = 2048;
+
+    static const int FRAME_SIZE = 2048;
+
+    static const int RING_SIZE = FRAMES / 2;
+
+    // Key and value of the answer map.
+    struct answer_key {
+        struct in6_addr target;
+
+        uint32_t ifindex;
+    };
+
+    struct answer {
+        uint8_t hwaddr[6];
+
+        uint8_t flags;
+
+        uint8_t pad;
+
+        uint32_t hits;
+    };
+
+    // Map of our own addresses, consulted by the XDP program.
+    static int _local_fd;
+
+    // Map of the solicitations the XDP program answers by itself, shared by
+    // all interfaces.
+    static int _answer_fd;
+
+    int _ifindex;
+
+    std::string _ifname;
+
+    int _fd;
+
+    // The XSKMAP the program redirects through, the program itself, and
+    // the link that keeps it attached to the interface.
+    int _map_fd, _prog_fd, _link_fd;
+
+    uint8_t* _umem;
+
+    ring _rx, _tx, _fill, _comp;
+
+    // Frames in the second half of the UMEM that aren't being transmitted.
+    std::vector<uint64_t> _tx_free;
+
+    // Number of frames queued by transmit() but not yet handed over.
+    uint32_t _tx_pending;
+
+    xsk();
+
+    bool setup(int ifindex);
+
+    bool map_ring(ring& r, int fd, off_t pgoff, const struct xdp_ring_offset& off, size_t desc_size);
+
+    bool load_program(int ifindex);
+
+    void reclaim();
+};
+
+NDPPD_NS_END
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Measures how much CPU time ndppd takes to handle a flood of solicitations
+# for addresses that aren't there, at the default log level. Compare
+# builds by passing several binaries, for example one built with
+# 'make NO_DEBUG_LOG=1':
+#
+#   make tests/ns_flood
+#   sudo tests/flood_bench.sh ./ndppd /tmp/ndppd-nodebug
+#
+# Sets up three network namespaces, cl <-> px <-> ho, joined by veth pairs
+# and runs each binary in px as a proxy for 2001:db8:1::/64 on ho's side.
+# Removes the namespaces again when done.
+
+COUNT=${COUNT:-4000}
+ROUNDS=${ROUNDS:-8}
+RUNS=${RUNS:-3}
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+TMP=$(mktemp -d)
+
+cleanup() {
+    for n in cl px ho; do ip netns del $n 2>/dev/null; done
+    rm -rf "$TMP"
+}
+
+trap cleanup EXIT
+
+if [ $# -eq 0 ] || [ ! -x "$DIR/ns_flood" ]; then
+    echo "Usage: $0 <ndppd binary>..." >&2
+    echo "Build tests/ns_flood first." >&2
+    exit 1
+fi
+
+for n in cl px ho; do
+    ip netns del $n 2>/dev/null
+    ip netns add $n || exit 1
+    ip -n $n link set lo up
+done
+
+ip link add c0 netns cl type veth peer name p0 netns px
+ip link add d0 netns px type veth peer name h0 netns ho
+ip -n cl link set c0 address 02:00:00:00:00:0c
+
+for l in cl:c0 px:p0 px:d0 ho:h0; do
+    ip netns exec ${l%:*} sysctl -qw net.ipv6.conf.${l#*:}.accept_dad=0
+    ip -n ${l%:*} link set ${l#*:} up
+done
+
+ip -n px addr add 2001:db8:1::1/64 dev d0 nodad
+
+cat > "$TMP/ndppd.conf" <<CONF
+proxy p0 {
+    timeout 200
+    retries 2
+    rule 2001:db8:1::/64 {
+        iface d0
+    }
+}
+CONF
+
+sleep 1
+
+for bin in "$@"; do
+    for run in $(seq $RUNS); do
+        ip netns exec px "$bin" -c "$TMP/ndppd.conf" > /dev/null 2>&1 &
+        pid=$!
+        sleep 0.5
+
+        ip netns exec cl "$DIR/ns_flood" c0 2001:db8:1:: $COUNT $ROUNDS > /dev/null
+        sleep 1
+
+        # CPU time of all threads, in nanoseconds.
+        ns=$(cat /proc/$pid/task/*/schedstat | awk '{ sum += $1 } END { print sum }')
+        echo "$bin: run $run: $((ns / 1000000)) ms"
+
+        kill $pid
+        wait $pid
+    done
+done
@@ -0,0 +1,102 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Measures what a debug message on the packet path costs when it isn't
+// written, as at the default log level. Each iteration builds the message
+// iface::read_solicit() logs for every solicitation, once through
+// logger::debug(), which formats it before looking at the level, and once
+// through DEBUG_LOG(). 'make bench' also builds this with NO_DEBUG_LOG,
+// where DEBUG_LOG() compiles to nothing.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "../src/ndppd.h"
+
+using namespace ndppd;
+
+// What address::to_string() does, without pulling in the rest of ndppd.
+static std::string to_string(const struct in6_addr& addr)
+{
+    char buf[INET6_ADDRSTRLEN];
+
+    inet_ntop(AF_INET6, &addr, buf, sizeof(buf));
+
+    return buf;
+}
+
+static double seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    long count = (argc > 1) ? atol(argv[1]) : 2000000;
+
+    struct in6_addr saddr, daddr, taddr;
+
+    inet_pton(AF_INET6, "fe80::c", &saddr);
+    inet_pton(AF_INET6, "ff02::1:ff00:100", &daddr);
+    inet_pton(AF_INET6, "2001:db8:1::100", &taddr);
+
+    // Read through a volatile, so the length can't be folded in.
+    volatile int len = 32;
+
+    double start = seconds();
+
+    for (long i = 0; i < count; i++) {
+        logger::debug() << "iface::read_solicit() saddr=" << to_string(saddr)
+                        << ", daddr=" << to_string(daddr) << ", taddr=" << to_string(taddr)
+                        << ", len=" << len;
+    }
+
+    double eager = seconds() - start;
+
+    start = seconds();
+
+    for (long i = 0; i < count; i++) {
+        // On the packet path, the level is looked at again for every
+        // message; don't let the compiler take it out of the loop.
+        __asm__ volatile("" ::: "memory");
+
+        DEBUG_LOG() << "iface::read_solicit() saddr=" << to_string(saddr)
+                    << ", daddr=" << to_string(daddr) << ", taddr=" << to_string(taddr)
+                    << ", len=" << len;
+    }
+
+    double lazy = seconds() - start;
+
+#ifdef NDPPD_NO_DEBUG_LOG
+    const char* build = "NO_DEBUG_LOG build";
+#else
+    const char* build = "default build";
+#endif
+
+    printf("%s, %ld messages not written:\n", build, count);
+    printf("  logger::debug(): %8.2f ns/message\n", eager * 1e9 / count);
+    printf("  DEBUG_LOG():     %8.2f ns/message\n", lazy * 1e9 / count);
+
+    return 0;
+}
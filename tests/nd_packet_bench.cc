@@ -0,0 +1,78 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Measures how many frames per second parse_frame() gets through, with a
+// solicitation carrying a source link-layer address option.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <time.h>
+
+#include "../src/ndppd.h"
+#include "../src/nd_packet.h"
+
+using namespace ndppd;
+
+static const uint8_t ns_frame[] = {
+    0x33, 0x33, 0xff, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x0c,
+    0x86, 0xdd, 0x60, 0x00, 0x00, 0x00, 0x00, 0x20, 0x3a, 0xff, 0xfe, 0x80,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x0c, 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0xff, 0x00, 0x01, 0x00, 0x87, 0x00, 0x49, 0x4c, 0x00, 0x00,
+    0x00, 0x00, 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x02, 0x00, 0x00, 0x00,
+    0x00, 0x0c
+};
+
+static double seconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    long count = (argc > 1) ? atol(argv[1]) : 20000000;
+
+    // Read through a volatile pointer, so the parse can't be hoisted out
+    // of the loop.
+    const uint8_t* volatile frame = ns_frame;
+
+    nd_packet pkt;
+
+    long accepted = 0;
+
+    double start = seconds();
+
+    for (long i = 0; i < count; i++)
+        accepted += pkt.parse_frame(frame, sizeof(ns_frame));
+
+    double elapsed = seconds() - start;
+
+    if (accepted != count) {
+        fprintf(stderr, "Only %ld of %ld frames accepted\n", accepted, count);
+        return 1;
+    }
+
+    printf("parse_frame: %ld frames in %.3f s, %.1f ns/frame, %.2f Mframes/s\n",
+           count, elapsed, elapsed * 1e9 / count, count / elapsed / 1e6);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Fuzzes nd_packet. Built with libFuzzer (-fsanitize=fuzzer and
+// -DNDPPD_LIBFUZZER), this is a regular fuzz target. Otherwise it has a
+// main() of its own, which takes the frames in the corpus directory given on
+// the command line and keeps mutating them at random. Either way, it's meant
+// to be built with AddressSanitizer, so that any read past the end of a
+// frame stops it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+
+#include <dirent.h>
+#include <net/ethernet.h>
+
+#include "../src/ndppd.h"
+#include "../src/nd_packet.h"
+
+using namespace ndppd;
+
+// Keeps the compiler from leaving out the reads.
+static volatile uint8_t sink;
+
+static void touch(const nd_packet& pkt)
+{
+    sink ^= pkt.type();
+    sink ^= pkt.target().s6_addr[15];
+
+    if (pkt.slla())
+        sink ^= pkt.slla()[5];
+
+    if (pkt.tlla())
+        sink ^= pkt.tlla()[5];
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    // A copy of exactly the right size, so that nothing past it is readable.
+    uint8_t* buf = new uint8_t[size];
+
+    if (size)
+        memcpy(buf, data, size);
+
+    nd_packet pkt;
+
+    if (pkt.parse_frame(buf, size))
+        touch(pkt);
+
+    // The same bytes as read from a raw socket.
+    if (size > ETH_HLEN + sizeof(struct ip6_hdr) &&
+        pkt.parse_icmp(buf + ETH_HLEN + sizeof(struct ip6_hdr),
+                       size - ETH_HLEN - sizeof(struct ip6_hdr), 255))
+        touch(pkt);
+
+    delete[] buf;
+
+    return 0;
+}
+
+#ifndef NDPPD_LIBFUZZER
+
+static void mutate(std::vector<uint8_t>& data)
+{
+    for (int n = 1 + rand() % 4; n > 0; n--) {
+        size_t pos = data.empty() ? 0 : rand() % data.size();
+
+        switch (rand() % 6) {
+        case 0:
+            if (!data.empty())
+                data[pos] ^= 1 << (rand() % 8);
+            break;
+
+        case 1:
+            if (!data.empty())
+                data[pos] = rand();
+            break;
+
+        case 2:
+            // The length fields, the option lengths and the flags are what
+            // the parser cares about most.
+            if (!data.empty())
+                data[pos] = (rand() & 1) ? 0 : 0xff;
+            break;
+
+        case 3:
+            data.resize(pos);
+            break;
+
+        case 4:
+            data.insert(data.begin() + pos, (uint8_t)rand());
+            break;
+
+        case 5:
+            data.resize(data.size() + 8 * (1 + rand() % 4), (uint8_t)rand());
+            break;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <corpus> [iterations] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    long iterations = (argc > 2) ? atol(argv[2]) : 1000000;
+
+    srand((argc > 3) ? atoi(argv[3]) : 1);
+
+    std::vector<std::vector<uint8_t> > seeds;
+
+    DIR* d = opendir(argv[1]);
+
+    if (!d) {
+        fprintf(stderr, "Unable to open corpus '%s'\n", argv[1]);
+        return 1;
+    }
+
+    while (struct dirent* de = readdir(d)) {
+        if (de->d_name[0] == '.')
+            continue;
+
+        std::string path = std::string(argv[1]) + "/" + de->d_name;
+        std::ifstream ifs(path.c_str(), std::ios::in | std::ios::binary);
+
+        seeds.push_back(std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs),
+                                             std::istreambuf_iterator<char>()));
+    }
+
+    closedir(d);
+
+    if (seeds.empty()) {
+        fprintf(stderr, "No frames in '%s'\n", argv[1]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < seeds.size(); i++)
+        LLVMFuzzerTestOneInput(seeds[i].empty() ? NULL : &seeds[i][0], seeds[i].size());
+
+    for (long i = 0; i < iterations; i++) {
+        std::vector<uint8_t> data = seeds[rand() % seeds.size()];
+
+        mutate(data);
+
+        LLVMFuzzerTestOneInput(data.empty() ? NULL : &data[0], data.size());
+    }
+
+    printf("%ld frames\n", iterations + (long)seeds.size());
+
+    return 0;
+}
+
+#endif
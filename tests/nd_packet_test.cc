@@ -0,0 +1,236 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Checks nd_packet and icmp6_checksum() against a few messages whose
+// checksums were worked out independently, then runs every frame in the
+// corpus directory given on the command line through parse_frame(). Frames
+// named valid-* must be accepted, and all others rejected.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+
+#include "../src/ndppd.h"
+#include "../src/nd_packet.h"
+
+using namespace ndppd;
+
+static int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char* what, int line)
+{
+    if (!ok) {
+        fprintf(stderr, "nd_packet_test.cc:%d: check failed: %s\n", line, what);
+        failures++;
+    }
+}
+
+// A solicitation from fe80::c for 2001:db8:1::100, with a source link-layer
+// address option, and the advertisement answering it.
+static const uint8_t ns_frame[] = {
+    0x33, 0x33, 0xff, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x0c,
+    0x86, 0xdd, 0x60, 0x00, 0x00, 0x00, 0x00, 0x20, 0x3a, 0xff, 0xfe, 0x80,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x0c, 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0xff, 0x00, 0x01, 0x00, 0x87, 0x00, 0x49, 0x4c, 0x00, 0x00,
+    0x00, 0x00, 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x01, 0x02, 0x00, 0x00, 0x00,
+    0x00, 0x0c
+};
+
+static const uint8_t na_frame[] = {
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x0d, 0x02, 0x00, 0x00, 0x00, 0x00, 0x0c,
+    0x86, 0xdd, 0x60, 0x00, 0x00, 0x00, 0x00, 0x20, 0x3a, 0xff, 0x20, 0x01,
+    0x0d, 0xb8, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x88, 0x00, 0xb7, 0x95, 0x60, 0x00,
+    0x00, 0x00, 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x01, 0x02, 0x00, 0x00, 0x00,
+    0x00, 0x0d
+};
+
+static const size_t ICMP_OFFSET = ETH_HLEN + sizeof(struct ip6_hdr);
+
+static const uint8_t target[16] = {
+    0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x00
+};
+
+// Returns the checksum of the message in 'frame' computed with the checksum
+// field cleared, in host byte order.
+static uint16_t checksum_of(const uint8_t* frame, size_t len)
+{
+    std::vector<uint8_t> buf(frame, frame + len);
+
+    buf[ICMP_OFFSET + 2] = 0;
+    buf[ICMP_OFFSET + 3] = 0;
+
+    return ntohs(icmp6_checksum(&buf[ETH_HLEN + 8], &buf[ICMP_OFFSET], len - ICMP_OFFSET));
+}
+
+static void test_checksum()
+{
+    CHECK(checksum_of(ns_frame, sizeof(ns_frame)) == 0x494c);
+    CHECK(checksum_of(na_frame, sizeof(na_frame)) == 0xb795);
+
+    // Over a message with a correct checksum in place, it comes out zero.
+    CHECK(icmp6_checksum(ns_frame + ETH_HLEN + 8, ns_frame + ICMP_OFFSET,
+                         sizeof(ns_frame) - ICMP_OFFSET) == 0);
+
+    // An odd number of bytes, 1 to 29, sent from fe80::1 to fe80::2.
+    struct in6_addr addrs[2];
+
+    inet_pton(AF_INET6, "fe80::1", &addrs[0]);
+    inet_pton(AF_INET6, "fe80::2", &addrs[1]);
+
+    uint8_t odd[29];
+
+    for (size_t i = 0; i < sizeof(odd); i++)
+        odd[i] = i + 1;
+
+    CHECK(ntohs(icmp6_checksum((const uint8_t* )addrs, odd, sizeof(odd))) == 0x20d1);
+}
+
+static void test_solicit()
+{
+    nd_packet pkt;
+
+    CHECK(pkt.parse_frame(ns_frame, sizeof(ns_frame)));
+    CHECK(pkt.type() == ND_NEIGHBOR_SOLICIT);
+    CHECK(pkt.has_ip6());
+    CHECK(!memcmp(&pkt.src(), ns_frame + ETH_HLEN + 8, 16));
+    CHECK(!memcmp(&pkt.dst(), ns_frame + ETH_HLEN + 24, 16));
+    CHECK(!memcmp(&pkt.target(), target, sizeof(target)));
+    CHECK(pkt.slla() && !memcmp(pkt.slla(), "\x02\x00\x00\x00\x00\x0c", 6));
+    CHECK(!pkt.tlla());
+
+    // Every byte counts.
+    for (size_t len = 0; len < sizeof(ns_frame); len++)
+        CHECK(!pkt.parse_frame(ns_frame, len));
+}
+
+static void test_advert()
+{
+    nd_packet pkt;
+
+    CHECK(pkt.parse_frame(na_frame, sizeof(na_frame)));
+    CHECK(pkt.type() == ND_NEIGHBOR_ADVERT);
+    CHECK(!memcmp(&pkt.target(), target, sizeof(target)));
+    CHECK(pkt.flags() == (ND_NA_FLAG_SOLICITED | ND_NA_FLAG_OVERRIDE));
+    CHECK(pkt.tlla() && !memcmp(pkt.tlla(), "\x02\x00\x00\x00\x00\x0d", 6));
+    CHECK(!pkt.slla());
+
+    // As read from the raw socket, which has checked the checksum and
+    // hands over the hop limit separately.
+    const uint8_t* msg = na_frame + ICMP_OFFSET;
+    size_t len         = sizeof(na_frame) - ICMP_OFFSET;
+
+    CHECK(pkt.parse_icmp(msg, len, 255));
+    CHECK(!pkt.has_ip6());
+    CHECK(pkt.type() == ND_NEIGHBOR_ADVERT);
+    CHECK(!pkt.parse_icmp(msg, len, 64));
+    CHECK(!pkt.parse_icmp(msg, sizeof(struct nd_neighbor_advert) - 1, 255));
+    CHECK(!pkt.parse_icmp(msg, len - 1, 255));
+}
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data)
+{
+    std::ifstream ifs(path.c_str(), std::ios::in | std::ios::binary);
+
+    if (!ifs)
+        return false;
+
+    data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+    return true;
+}
+
+static void test_corpus(const std::string& dir)
+{
+    DIR* d = opendir(dir.c_str());
+
+    if (!d) {
+        fprintf(stderr, "Unable to open corpus '%s'\n", dir.c_str());
+        failures++;
+        return;
+    }
+
+    std::vector<std::string> names;
+
+    while (struct dirent* de = readdir(d)) {
+        if (de->d_name[0] != '.')
+            names.push_back(de->d_name);
+    }
+
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+
+    for (std::vector<std::string>::iterator it = names.begin(); it != names.end(); it++) {
+        std::vector<uint8_t> data;
+
+        if (!read_file(dir + "/" + *it, data)) {
+            fprintf(stderr, "Unable to read '%s'\n", it->c_str());
+            failures++;
+            continue;
+        }
+
+        // Exactly as long as the frame, so that nothing past it is readable.
+        uint8_t* buf = new uint8_t[data.size()];
+        std::copy(data.begin(), data.end(), buf);
+
+        nd_packet pkt;
+
+        bool expected = !it->compare(0, 6, "valid-");
+
+        if (pkt.parse_frame(buf, data.size()) != expected) {
+            fprintf(stderr, "%s: %s\n", it->c_str(), expected ? "rejected" : "accepted");
+            failures++;
+        }
+
+        delete[] buf;
+    }
+
+    printf("%d corpus frames\n", (int)names.size());
+}
+
+int main(int argc, char* argv[])
+{
+    test_checksum();
+    test_solicit();
+    test_advert();
+
+    if (argc > 1)
+        test_corpus(argv[1]);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+
+    return 0;
+}
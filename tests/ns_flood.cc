@@ -0,0 +1,159 @@
+// ndppd - NDP Proxy Daemon
+// Copyright (C) 2011  Daniel Adolfsson <daniel@priv.nu>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Sends a flood of Neighbor Solicitations out of an interface, for
+// flood_bench.sh: 'rounds' times, one for each of the targets
+// <prefix>1 to <prefix><count>, from fe80::c and the link-layer address
+// 02:00:00:00:00:0c. Needs CAP_NET_RAW.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netpacket/packet.h>
+#include <sys/socket.h>
+
+#include "../src/ndppd.h"
+#include "../src/nd_packet.h"
+
+using namespace ndppd;
+
+static const uint8_t smac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x0c };
+
+// Builds the solicitation for 'taddr' in 'buf', and returns its size.
+static size_t build(uint8_t* buf, const struct in6_addr& taddr)
+{
+    struct in6_addr saddr, daddr;
+
+    inet_pton(AF_INET6, "fe80::c", &saddr);
+
+    // The solicited-node address.
+    inet_pton(AF_INET6, "ff02::1:ff00:0", &daddr);
+    memcpy(&daddr.s6_addr[13], &taddr.s6_addr[13], 3);
+
+    struct ether_header* eh = (struct ether_header* )buf;
+
+    eh->ether_dhost[0] = 0x33;
+    eh->ether_dhost[1] = 0x33;
+    memcpy(&eh->ether_dhost[2], &daddr.s6_addr[12], 4);
+    memcpy(eh->ether_shost, smac, 6);
+    eh->ether_type = htons(ETHERTYPE_IPV6);
+
+    struct ip6_hdr ip6h;
+
+    memset(&ip6h, 0, sizeof(ip6h));
+    ip6h.ip6_flow = htonl(6 << 28);
+    ip6h.ip6_plen = htons(sizeof(struct nd_neighbor_solicit) + 8);
+    ip6h.ip6_nxt  = IPPROTO_ICMPV6;
+    ip6h.ip6_hlim = 255;
+    ip6h.ip6_src  = saddr;
+    ip6h.ip6_dst  = daddr;
+
+    struct nd_neighbor_solicit ns;
+
+    memset(&ns, 0, sizeof(ns));
+    ns.nd_ns_type   = ND_NEIGHBOR_SOLICIT;
+    ns.nd_ns_target = taddr;
+
+    uint8_t* icmp = buf + ETH_HLEN + sizeof(ip6h);
+
+    memcpy(buf + ETH_HLEN, &ip6h, sizeof(ip6h));
+    memcpy(icmp, &ns, sizeof(ns));
+
+    uint8_t* opt = icmp + sizeof(ns);
+
+    opt[0] = ND_OPT_SOURCE_LINKADDR;
+    opt[1] = 1;
+    memcpy(opt + 2, smac, 6);
+
+    size_t len = sizeof(ns) + 8;
+
+    uint16_t sum = icmp6_checksum((const uint8_t* )&ip6h.ip6_src, icmp, len);
+    memcpy(icmp + 2, &sum, sizeof(sum));
+
+    return ETH_HLEN + sizeof(ip6h) + len;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <interface> <prefix> <count> <rounds>\n", argv[0]);
+        return 1;
+    }
+
+    int count  = atoi(argv[3]);
+    int rounds = atoi(argv[4]);
+
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IPV6));
+
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    struct sockaddr_ll sll;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IPV6);
+
+    if (!(sll.sll_ifindex = if_nametoindex(argv[1]))) {
+        fprintf(stderr, "No interface '%s'\n", argv[1]);
+        return 1;
+    }
+
+    if (bind(fd, (struct sockaddr* )&sll, sizeof(sll)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    long sent = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 1; i <= count; i++) {
+            char str[INET6_ADDRSTRLEN + 16];
+            struct in6_addr taddr;
+
+            snprintf(str, sizeof(str), "%s%x", argv[2], i);
+
+            if (inet_pton(AF_INET6, str, &taddr) != 1) {
+                fprintf(stderr, "Bad target '%s'\n", str);
+                return 1;
+            }
+
+            uint8_t buf[128];
+            size_t len = build(buf, taddr);
+
+            // Let the receiver keep up, rather than measure drops.
+            while (send(fd, buf, len, 0) < 0)
+                usleep(100);
+
+            sent++;
+        }
+
+        usleep(200000);
+    }
+
+    printf("%ld solicitations sent\n", sent);
+
+    return 0;
+}